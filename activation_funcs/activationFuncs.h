@@ -6,38 +6,17 @@
 #define DEEPDENDRO_ACTIVATIONFUNCS_H
 
 #include <exception>
+#include "approxMath.h"
 #include "Layer.h"
-#include <map>
 #include <unsupported/Eigen/CXX11/Tensor>
 
-template<typename T>
-using ActivationFunc = T (*)(const T &input);
 
-
-
-template<typename T>
-T ReLU(const T &input) {
-    return input.cwiseMax(0);
-}
-
-template<typename T>
-T Sigmoid(const T &input) {
-    return 1.0 / (1.0 + (-input.array()).exp());
-}
-
-template<typename T>
-T Tanh(const T &input) {
-    return input.array().tanh();
-}
-
-template<typename T, typename V>
-T Softmax(const T &input) {
-    // applies softmax to every column of the matrix
-    T expMatrix = input.array().exp();
-    V sumExp = expMatrix.colwise().sum();
-    T result = expMatrix.array().rowwise() / sumExp.transpose().array();
-    return result;
-}
+enum activation {
+    sigmoid,
+    relu,
+    tanhyper,
+    softmax
+};
 
 
 class ActivationNotFound : public std::exception {
@@ -48,4 +27,190 @@ public:
 };
 
 
+// Activations as policy types, shared by the dense (Matrix) and the convolutional (Tensor) paths.
+// forward(z) and derivative(a) return Eigen expressions of an array or a tensor expression, so the caller
+// can fuse them with what surrounds them (e.g. delta = derivative(a) * gradient in one pass).
+// derivative() takes the cached outputs a = f(z), not z: for all of these f' is a function of f,
+// so a layer never needs to keep its pre-activations for the backward pass.
+// The exponential activations take the precision of their exp/tanh as a template argument
+// (BasicSigmoid<precision::fast>, ...); Sigmoid, Tanh and Softmax are the exact ones.
+namespace act {
+    namespace detail {
+        template<typename Derived>
+        auto max0(const Eigen::ArrayBase<Derived> &x) {
+            return x.max(typename Derived::Scalar(0));
+        }
+
+        template<typename Derived>
+        auto max0(const Eigen::TensorBase<Derived, Eigen::ReadOnlyAccessors> &x) {
+            using Scalar = typename Eigen::internal::traits<Derived>::Scalar;
+            return static_cast<const Derived &>(x).cwiseMax(Scalar(0));
+        }
+
+        template<typename X>
+        using scalar_t = typename Eigen::internal::traits<X>::Scalar;
+
+        template<precision P, template<typename, precision> class Op, typename X>
+        auto approximate(const X &x) {
+            return x.unaryExpr(Op<scalar_t<X>, P>());
+        }
+    }
+
+    struct Relu {
+        static constexpr activation type = activation::relu;
+        static constexpr bool elementwise = true;
+
+        template<typename X>
+        static auto forward(const X &z) {
+            return detail::max0(z);
+        }
+
+        template<typename X>
+        static auto derivative(const X &a) {
+            using Scalar = detail::scalar_t<X>;
+            return (a > Scalar(0)).template cast<Scalar>();
+        }
+    };
+
+    template<precision P = precision::exact>
+    struct BasicSigmoid {
+        static constexpr activation type = activation::sigmoid;
+        static constexpr bool elementwise = true;
+
+        template<typename X>
+        static auto forward(const X &z) {
+            using Scalar = detail::scalar_t<X>;
+            if constexpr (P == precision::exact) {
+                return ((-z).exp() + Scalar(1)).inverse();
+            } else {
+                return detail::approximate<P, approx::sigmoid_op>(z);
+            }
+        }
+
+        // a * (1 - a)
+        template<typename X>
+        static auto derivative(const X &a) {
+            using Scalar = detail::scalar_t<X>;
+            return a * (-a + Scalar(1));
+        }
+    };
+
+    template<precision P = precision::exact>
+    struct BasicTanh {
+        static constexpr activation type = activation::tanhyper;
+        static constexpr bool elementwise = true;
+
+        template<typename X>
+        static auto forward(const X &z) {
+            if constexpr (P == precision::exact) {
+                return z.tanh();
+            } else {
+                return detail::approximate<P, approx::tanh_op>(z);
+            }
+        }
+
+        // 1 - a^2
+        template<typename X>
+        static auto derivative(const X &a) {
+            using Scalar = detail::scalar_t<X>;
+            return -a.square() + Scalar(1);
+        }
+    };
+
+    // Normalizes every column of a matrix (every sample), or a whole tensor, so it has no elementwise
+    // forward(); the derivative is the diagonal of the Jacobian, a * (1 - a)
+    template<precision P = precision::exact>
+    struct BasicSoftmax {
+        static constexpr activation type = activation::softmax;
+        static constexpr bool elementwise = false;
+
+        template<typename X>
+        static auto exp(const X &x) {
+            if constexpr (P == precision::exact) {
+                return x.exp();
+            } else {
+                return detail::approximate<P, approx::exp_op>(x);
+            }
+        }
+
+        template<typename X>
+        static auto derivative(const X &a) {
+            using Scalar = detail::scalar_t<X>;
+            return a * (-a + Scalar(1));
+        }
+    };
+
+    using Sigmoid = BasicSigmoid<>;
+    using Tanh = BasicTanh<>;
+    using Softmax = BasicSoftmax<>;
+
+    // x = f(x) in place, every column of x being one sample: a matrix, a map, a block of columns
+    template<typename Policy, typename Derived>
+    void activate(const Eigen::MatrixBase<Derived> &x_) {
+        // Eigen's idiom for writing through a temporary block expression
+        auto &x = const_cast<Eigen::MatrixBase<Derived> &>(x_);
+        if constexpr (Policy::elementwise) {
+            x.array() = Policy::forward(x.array());
+        } else {
+            // the column max is subtracted first so that large logits do not overflow exp
+            for (Eigen::Index j = 0; j < x.cols(); ++j) {
+                auto column = x.col(j);
+                column.array() = Policy::exp(column.array() - column.maxCoeff());
+                column /= column.sum();
+            }
+        }
+    }
+
+    // the same for one tensor, which softmax normalizes as a whole
+    template<typename Policy, typename Scalar, int Rank>
+    void activate(Eigen::Tensor<Scalar, Rank> &x) {
+        if constexpr (Policy::elementwise) {
+            x = Policy::forward(x);
+        } else {
+            const Eigen::Tensor<Scalar, 0> max = x.maximum();
+            x = Policy::exp(x - max());
+            const Eigen::Tensor<Scalar, 0> sum = x.sum();
+            x = x / sum();
+        }
+    }
+
+    namespace detail {
+        template<template<precision> class Policy, typename F>
+        decltype(auto) with_precision(const precision accuracy, F &&f) {
+            switch (accuracy) {
+                case precision::fast:
+                    return f(Policy<precision::fast>{});
+                case precision::fastest:
+                    return f(Policy<precision::fastest>{});
+                default:
+                    return f(Policy<precision::exact>{});
+            }
+        }
+    }
+
+    // Calls f with the policy of a run-time activation, f(Relu{}) etc.: a layer picks its activation at
+    // run time once per call, the kernel inside f is compiled for every policy
+    template<typename F>
+    decltype(auto) dispatch(const activation type, const precision accuracy, F &&f) {
+        switch (type) {
+            case relu:
+                return f(Relu{});
+            case sigmoid:
+                return detail::with_precision<BasicSigmoid>(accuracy, f);
+            case tanhyper:
+                return detail::with_precision<BasicTanh>(accuracy, f);
+            case softmax:
+                return detail::with_precision<BasicSoftmax>(accuracy, f);
+            default:
+                throw ActivationNotFound();
+        }
+    }
+
+    template<typename F>
+    decltype(auto) dispatch(const activation type, F &&f) {
+        return dispatch(type, precision::exact, std::forward<F>(f));
+    }
+}
+
+
 #endif //DEEPDENDRO_ACTIVATIONFUNCS_H
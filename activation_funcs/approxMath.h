@@ -0,0 +1,177 @@
+#ifndef DEEPDENDRO_APPROXMATH_H
+#define DEEPDENDRO_APPROXMATH_H
+
+#include <cmath>
+#include <limits>
+#include <Eigen/Dense>
+
+// How exactly the activations compute their transcendental functions.
+// exact uses Eigen's own exp/tanh; fast and fastest use the polynomial kernels below. Maximum errors
+// measured over the whole input range, for float and double (log: plus the rounding of the result):
+//                  exp (relative)   sigmoid (absolute)   tanh (absolute)   log (absolute)
+//     fast         2e-7             1e-7                 4e-7              5e-8
+//     fastest      8e-5             2e-5                 4e-5              2e-5
+// Float sigmoid is about twice as fast as with exact, double tanh about five times.
+// The softmax + cross-entropy loss head of training always stays exact.
+enum class precision {
+    exact,
+    fast,
+    fastest
+};
+
+// Elementwise kernels as Eigen functors: their packetOp is written with Eigen's packet primitives, so
+// z.unaryExpr(approx::exp_op<Scalar, precision::fast>()) is vectorized for matrices and tensors alike
+// (SSE, AVX, NEON, float and double), and operator() is the same code on one scalar.
+namespace approx {
+    namespace detail {
+        using namespace Eigen::internal;
+
+        template<typename Packet>
+        using scalar_of = typename unpacket_traits<Packet>::type;
+
+        // c[0] + c[1] x + ... by Horner's rule
+        template<typename Packet, size_t N>
+        EIGEN_STRONG_INLINE Packet horner(const Packet &x, const double (&c)[N]) {
+            using Scalar = scalar_of<Packet>;
+            Packet result = pset1<Packet>(static_cast<Scalar>(c[N - 1]));
+            for (size_t i = N - 1; i-- > 0;) {
+                result = pmadd(result, x, pset1<Packet>(static_cast<Scalar>(c[i])));
+            }
+            return result;
+        }
+
+        // minimax polynomials of exp(r) for |r| <= ln(2) / 2, relative error 7.5e-8 and 7.5e-5
+        constexpr double exp_fast[] = {1.0000000716546822, 0.9999996919915167, 0.49998894851221964,
+                                       0.16667574728755044, 0.04191538199169587, 0.008297655080363472};
+        constexpr double exp_fastest[] = {0.9999280735404956, 1.0001641857610948, 0.5049632641822398,
+                                          0.16566842347964333};
+
+        // minimax polynomials of atanh(s) / s in t = s^2, for |s| <= (sqrt(2) - 1) / (sqrt(2) + 1)
+        constexpr double log_fast[] = {1.0000001186870138, 0.33326111850056, 0.20648186432627738};
+        constexpr double log_fastest[] = {0.9999777446768127, 0.33933992879342223};
+
+        // a * 2^n for an integral n that keeps the result normal: the exponent bits are built directly where
+        // Eigen has integer packets, its general pldexp also splits n to survive overflow and is slower
+        template<typename Packet>
+        EIGEN_STRONG_INLINE Packet times_pow2(const Packet &a, const Packet &n) {
+            if constexpr (unpacket_traits<Packet>::size == 1) {
+                return std::ldexp(a, static_cast<int>(n));
+            } else if constexpr (requires { typename unpacket_traits<Packet>::integer_packet; }) {
+                return pldexp_fast_impl<Packet>::run(a, n);
+            } else {
+                // Eigen 3.4 has no integer packets for double
+                return pldexp(a, n);
+            }
+        }
+
+        // exp(x) = 2^n exp(r) with n = round(x / ln 2); ln 2 is split in two so that r = x - n ln 2 stays
+        // exact for large n. The input is clamped so that 2^n and the result are finite and normal.
+        template<precision P, typename Packet>
+        EIGEN_STRONG_INLINE Packet exp(const Packet &x_in) {
+            using Scalar = scalar_of<Packet>;
+            constexpr bool single = sizeof(Scalar) == sizeof(float);
+            const Packet x = pmin(pmax(x_in, pset1<Packet>(Scalar(single ? -87.0 : -708.0))),
+                                  pset1<Packet>(Scalar(single ? 88.0 : 709.0)));
+            // rounding by adding and subtracting 1.5 * 2^mantissa bits, cheaper than pfloor without SSE4.1
+            const Packet shifter = pset1<Packet>(Scalar(single ? 12582912.0 : 6755399441055744.0));
+            const Packet n = psub(pmadd(x, pset1<Packet>(Scalar(1.4426950408889634)), shifter), shifter);
+            Packet r = psub(x, pmul(n, pset1<Packet>(Scalar(0.693145751953125))));
+            r = psub(r, pmul(n, pset1<Packet>(Scalar(1.4286068203094172e-06))));
+            const Packet p = P == precision::fastest ? horner(r, exp_fastest) : horner(r, exp_fast);
+            return times_pow2(p, n);
+        }
+
+        // 1 / (1 + exp(-x)); exp saturates, so the result goes to 0 and 1 without NaNs
+        template<precision P, typename Packet>
+        EIGEN_STRONG_INLINE Packet sigmoid(const Packet &x) {
+            const Packet one = pset1<Packet>(scalar_of<Packet>(1));
+            return pdiv(one, padd(one, exp<P>(pnegate(x))));
+        }
+
+        // 1 - 2 / (exp(2x) + 1): accurate in absolute terms, which is what f'(a) = 1 - a^2 needs.
+        // Eigen's own float tanh is already a vectorized rational approximation, faster than this one.
+        template<precision P, typename Packet>
+        EIGEN_STRONG_INLINE Packet tanh(const Packet &x) {
+            if constexpr (unpacket_traits<Packet>::size > 1 && packet_traits<scalar_of<Packet>>::HasTanh) {
+                return ptanh(x);
+            }
+            const Packet one = pset1<Packet>(scalar_of<Packet>(1));
+            const Packet two = pset1<Packet>(scalar_of<Packet>(2));
+            return psub(one, pdiv(two, padd(exp<P>(pmul(two, x)), one)));
+        }
+
+        // x = m 2^e with m in [sqrt(1/2), sqrt(2)), log(m) = 2 atanh(s) with s = (m - 1) / (m + 1).
+        // Defined for positive x; zero and denormals give the log of the smallest normal number.
+        template<precision P, typename Packet>
+        EIGEN_STRONG_INLINE Packet log(const Packet &x_in) {
+            using Scalar = scalar_of<Packet>;
+            const Packet one = pset1<Packet>(Scalar(1));
+            const Packet x = pmax(x_in, pset1<Packet>((std::numeric_limits<Scalar>::min)()));
+            Packet e;
+            Packet m = pfrexp(x, e);
+            const Packet small = pcmp_lt(m, pset1<Packet>(Scalar(0.7071067811865476)));
+            m = pselect(small, padd(m, m), m);
+            e = pselect(small, psub(e, one), e);
+            const Packet s = pdiv(psub(m, one), padd(m, one));
+            const Packet t = pmul(s, s);
+            const Packet atanh_over_s = P == precision::fastest ? horner(t, log_fastest) : horner(t, log_fast);
+            return pmadd(e, pset1<Packet>(Scalar(0.6931471805599453)), pmul(padd(s, s), atanh_over_s));
+        }
+    }
+
+#define DEEPDENDRO_APPROX_OP(NAME)                                                          \
+    template<typename Scalar, precision P>                                                  \
+    struct NAME##_op {                                                                      \
+        EIGEN_STRONG_INLINE Scalar operator()(const Scalar &x) const {                      \
+            return detail::NAME<P>(x);                                                      \
+        }                                                                                   \
+                                                                                            \
+        template<typename Packet>                                                           \
+        EIGEN_STRONG_INLINE Packet packetOp(const Packet &x) const {                        \
+            return detail::NAME<P>(x);                                                      \
+        }                                                                                   \
+    };
+
+    DEEPDENDRO_APPROX_OP(exp)
+    DEEPDENDRO_APPROX_OP(sigmoid)
+    DEEPDENDRO_APPROX_OP(tanh)
+    DEEPDENDRO_APPROX_OP(log)
+
+#undef DEEPDENDRO_APPROX_OP
+}
+
+namespace Eigen::internal {
+    template<typename Scalar, precision P>
+    struct functor_traits<approx::exp_op<Scalar, P>> {
+        enum {
+            Cost = 10 * NumTraits<Scalar>::MulCost, PacketAccess = packet_traits<Scalar>::HasExp
+        };
+    };
+
+    template<typename Scalar, precision P>
+    struct functor_traits<approx::sigmoid_op<Scalar, P>> {
+        enum {
+            Cost = 12 * NumTraits<Scalar>::MulCost + scalar_div_cost<Scalar, true>::value,
+            PacketAccess = packet_traits<Scalar>::HasExp && packet_traits<Scalar>::HasDiv
+        };
+    };
+
+    template<typename Scalar, precision P>
+    struct functor_traits<approx::tanh_op<Scalar, P>> {
+        enum {
+            Cost = 12 * NumTraits<Scalar>::MulCost + scalar_div_cost<Scalar, true>::value,
+            PacketAccess = packet_traits<Scalar>::HasExp && packet_traits<Scalar>::HasDiv
+        };
+    };
+
+    template<typename Scalar, precision P>
+    struct functor_traits<approx::log_op<Scalar, P>> {
+        enum {
+            Cost = 12 * NumTraits<Scalar>::MulCost + scalar_div_cost<Scalar, true>::value,
+            PacketAccess = packet_traits<Scalar>::HasLog && packet_traits<Scalar>::HasDiv
+        };
+    };
+}
+
+
+#endif //DEEPDENDRO_APPROXMATH_H
@@ -0,0 +1,83 @@
+// Throughput of MPMCQueue against TSQueue (a mutex-guarded deque), for 1 to 8 producer / consumer
+// pairs: single pushes and pops, and batches of 32.
+//     mpmc_queue_bench [elements]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+#include <thread>
+#include <vector>
+#include "mpmc_queue.h"
+#include "ts_queue.h"
+
+namespace {
+    // millions of elements per second through `pairs` producers and as many consumers
+    template<typename Produce, typename Consume>
+    double throughput(const int pairs, const long elements, Produce produce, Consume consume) {
+        const long share = elements / pairs;
+        const auto began = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (int i = 0; i < pairs; ++i) {
+            threads.emplace_back([&] { produce(share); });
+            threads.emplace_back([&] { consume(share); });
+        }
+        for (auto &thread: threads) {
+            thread.join();
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+        return static_cast<double>(share * pairs) / seconds / 1e6;
+    }
+}
+
+int main(int argc, char **argv) {
+    const long elements = argc > 1 ? std::atol(argv[1]) : 2000000;
+    std::printf("%ld elements, %u hardware threads\n", elements, std::thread::hardware_concurrency());
+    for (const int pairs: {1, 2, 4, 8}) {
+        TSQueue<long> locked;
+        const double baseline = throughput(pairs, elements, [&](const long n) {
+            for (long i = 0; i < n; ++i) {
+                locked.push(long(i));
+            }
+        }, [&](const long n) {
+            for (long i = 0; i < n; ++i) {
+                locked.pop();
+            }
+        });
+
+        MPMCQueue<long> queue(1024);
+        const double single = throughput(pairs, elements, [&](const long n) {
+            for (long i = 0; i < n; ++i) {
+                queue.push(i);
+            }
+        }, [&](const long n) {
+            long value;
+            for (long i = 0; i < n; ++i) {
+                queue.pop(value);
+            }
+        });
+
+        constexpr long batch = 32;
+        const double batched = throughput(pairs, elements, [&](const long n) {
+            long values[batch];
+            std::iota(values, values + batch, 0);
+            for (long i = 0; i < n;) {
+                const size_t pushed = queue.try_push_batch(values, static_cast<size_t>(std::min(batch, n - i)));
+                if (pushed == 0) {
+                    std::this_thread::yield();
+                }
+                i += static_cast<long>(pushed);
+            }
+        }, [&](const long n) {
+            long values[batch];
+            for (long i = 0; i < n;) {
+                i += static_cast<long>(queue.pop_batch(values, static_cast<size_t>(std::min(batch, n - i))));
+            }
+        });
+
+        std::printf("%d producers + %d consumers: TSQueue %.2f M/s, MPMCQueue %.2f M/s, batches of %ld %.2f M/s\n",
+                    pairs, pairs, baseline, single, batch, batched);
+    }
+    return EXIT_SUCCESS;
+}
@@ -2,4 +2,49 @@
 // Created by Yaroslav Korch on 30.03.2023.
 //
 
+#include <algorithm>
 #include "accuracy.h"
+
+ClassificationMetrics::ClassificationMetrics(const int n_classes, const size_t top_k) :
+        confusion{Confusion::Zero(n_classes, n_classes)},
+        top_k{std::min(std::max<size_t>(top_k, 1), static_cast<size_t>(std::max(n_classes, 1)))} {}
+
+void ClassificationMetrics::update(const std::vector<int> &predicted, const std::vector<int> &labels) {
+    for (size_t i = 0; i < labels.size(); ++i) {
+        add(predicted[i], labels[i]);
+    }
+}
+
+void ClassificationMetrics::update_top_k(const std::vector<int> &top_k_predictions, const std::vector<int> &labels) {
+    for (size_t i = 0; i < labels.size(); ++i) {
+        add_top_k(top_k_predictions.data() + i * top_k, labels[i]);
+    }
+}
+
+void ClassificationMetrics::merge(const ClassificationMetrics &other) {
+    confusion += other.confusion;
+    top_k_hits += other.top_k_hits;
+    n_samples += other.n_samples;
+}
+
+double ClassificationMetrics::accuracy() const {
+    if (n_samples == 0) return 0;
+    return static_cast<double>(confusion.trace()) / static_cast<double>(n_samples);
+}
+
+double ClassificationMetrics::top_k_accuracy() const {
+    if (n_samples == 0) return 0;
+    return static_cast<double>(top_k_hits) / static_cast<double>(n_samples);
+}
+
+double ClassificationMetrics::precision(const int cls) const {
+    const long long predicted = confusion.col(cls).sum();
+    if (predicted == 0) return 0;
+    return static_cast<double>(confusion(cls, cls)) / static_cast<double>(predicted);
+}
+
+double ClassificationMetrics::recall(const int cls) const {
+    const long long actual = confusion.row(cls).sum();
+    if (actual == 0) return 0;
+    return static_cast<double>(confusion(cls, cls)) / static_cast<double>(actual);
+}
@@ -5,10 +5,80 @@
 #ifndef DEEPDENDRO_ACCURACY_H
 #define DEEPDENDRO_ACCURACY_H
 
+#include <vector>
+#include <Eigen/Dense>
 
-class accuracy {
+// Streaming classification metrics over class indices (not one-hot matrices).
+// Samples are added batch by batch; partial results of different threads are combined with merge().
+class ClassificationMetrics {
+    using Confusion = Eigen::Matrix<long long, Eigen::Dynamic, Eigen::Dynamic>;
 
+    // confusion(true label, predicted class)
+    Confusion confusion;
+    size_t top_k;
+    long long top_k_hits = 0;
+    long long n_samples = 0;
+
+public:
+    // top_k is clamped to [1, n_classes], k() gives the value used
+    explicit ClassificationMetrics(int n_classes, size_t top_k = 1);
+
+    void add(int predicted, int label) {
+        ++confusion(label, predicted);
+        ++n_samples;
+    }
+
+    // top holds the k() best classes of one sample, best first
+    void add_top_k(const int *top, int label) {
+        add(top[0], label);
+        for (size_t i = 0; i < top_k; ++i) {
+            if (top[i] == label) {
+                ++top_k_hits;
+                break;
+            }
+        }
+    }
+
+    void update(const std::vector<int> &predicted, const std::vector<int> &labels);
+
+    // top_k_predictions as returned by Model::predict_top_k with this object's k()
+    void update_top_k(const std::vector<int> &top_k_predictions, const std::vector<int> &labels);
+
+    void merge(const ClassificationMetrics &other);
+
+    [[nodiscard]] double accuracy() const;
+
+    // fraction of samples whose label is among the top_k predictions (tracked by add_top_k only)
+    [[nodiscard]] double top_k_accuracy() const;
+
+    [[nodiscard]] double precision(int cls) const;
+
+    [[nodiscard]] double recall(int cls) const;
+
+    [[nodiscard]] const Confusion &confusion_matrix() const {
+        return confusion;
+    }
+
+    [[nodiscard]] long long samples() const {
+        return n_samples;
+    }
+
+    [[nodiscard]] size_t k() const {
+        return top_k;
+    }
 };
 
+// index of the hot entry of every column of a one-hot label matrix
+template<typename Derived>
+std::vector<int> labels_to_indices(const Eigen::MatrixBase<Derived> &one_hot) {
+    std::vector<int> indices(one_hot.cols());
+    Eigen::Index label;
+    for (Eigen::Index i = 0; i < one_hot.cols(); ++i) {
+        one_hot.col(i).maxCoeff(&label);
+        indices[i] = static_cast<int>(label);
+    }
+    return indices;
+}
+
 
 #endif //DEEPDENDRO_ACCURACY_H
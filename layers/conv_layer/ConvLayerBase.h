@@ -10,6 +10,8 @@
 #include "Filter.h"
 #include "Pooling.h"
 #include "common_funcs.h"
+#include "Layer.h"
+#include "execution_context.h"
 #include <vector>
 
 
@@ -20,12 +22,16 @@ enum ConvSTEPS {
     APPLY_BACKPROP
 };
 
-template<size_t ConvLDimension>
+template<size_t ConvLDimension, typename Scalar = double>
 class ConvLayer {
 protected:
-    using ConvLT = Eigen::Tensor<double, ConvLDimension>;
+    using ConvLT = Eigen::Tensor<Scalar, ConvLDimension>;
     using Shape = Eigen::array<Eigen::Index, ConvLDimension>;
-    using Filters = std::vector<Filter<ConvLDimension>>;
+    using Filters = std::vector<Filter<ConvLDimension, Scalar>>;
+    using Matrix = MatrixT<Scalar>;
+    using Vector = VectorT<Scalar>;
+    using MatrixMap = MatrixMapT<Scalar>;
+    using ConstRef = Eigen::Ref<const Matrix>;
 
     const static size_t DIMENSION = ConvLDimension; // might be useful for derived classes
 
@@ -39,9 +45,35 @@ protected:
     Eigen::array<ptrdiff_t, ConvLDimension> dims_to_convolve;
 
     std::vector<ConvLT> dK_grads;
-    std::vector<double> dB_grads;
+    std::vector<Scalar> dB_grads;
 
-    ConvLT convolve(const Filter<ConvLDimension> &filter);
+    Optimizer<Scalar> optimizer;
+
+    // batched path: every column of these matrices is one sample's flattened tensor
+    Shape input_shape;
+    // activated in place, no pre-activations: the backward pass takes the derivative from a_values,
+    // or from a bit mask for ReLU layers
+    ReluMask<Scalar> relu_mask;
+    BufferView<Scalar> a_values;
+    BufferView<Scalar> delta;
+    BufferView<Scalar> input_gradient;
+    WorkspaceStorage<Scalar> storage;
+    // one filter's slice of one sample's delta, and the same zero-padded for the full convolution of dX
+    ConvLT delta_piece;
+    ConvLT padded_delta;
+    Shape padding_offsets;
+    // kernels flipped in every dimension, refreshed at every backward pass
+    std::vector<ConvLT> rotated_kernels;
+
+    activation activ_type;
+    precision activ_precision = precision::exact;
+
+    ConvLT convolve(const Filter<ConvLDimension, Scalar> &filter);
+
+    // biases + convolution of every filter for one flattened sample, written into one flattened output
+    void convolve_sample(const Scalar *input, Scalar *output) const;
+
+    void bind_views(Eigen::Index batch_size, Scalar *saved, Scalar *a, Scalar *delta_buffer, Scalar *gradient);
 
     size_t last_step_done = ConvSTEPS::NOTHING;
 
@@ -52,20 +84,96 @@ public:
 
     ConvLT calc_back_prop(const ConvLT &delta);
 
+    // Batched interface, used by Model: the samples are the columns of the matrices.
+    // Sizes every buffer for batch_size columns, after that a step does no allocations.
+    void reserve_workspace(Eigen::Index batch_size);
+
+    // same, in memory owned by the caller: `saved` of saved_size(batch_size), a and delta of
+    // output size x batch_size, gradient of input size x batch_size (null if it is never propagated)
+    void bind_workspace(Eigen::Index batch_size, Scalar *saved, Scalar *a, Scalar *delta_buffer, Scalar *gradient);
+
+    // true for ReLU layers, which keep a bit mask from forward to backward; the others need their
+    // a_values until their backward pass instead
+    bool saves_mask() const {
+        return activ_type == activation::relu;
+    }
+
+    // Scalars kept from the forward pass for the backward one besides a_values: the ReLU mask, or nothing
+    Eigen::Index saved_size(const Eigen::Index batch_size) const {
+        return saves_mask() ? ReluMask<Scalar>::scalars_for(convolved_output.size() * batch_size) : 0;
+    }
+
+    const MatrixMap &forward_prop(const ConstRef &input);
+
+    // accumulates the mean kernel and bias gradients of the batch for apply_back_prop and returns the
+    // gradient w.r.t. the input, unless `propagate` is off (first layer of a model)
+    const MatrixMap &calc_back_prop(const ConstRef &gradient, const ConstRef &input, bool propagate = true);
+
+    // read-only forward pass for inference, output must not overlap input
+    void infer(const Eigen::Ref<const Matrix> &input, Eigen::Ref<Matrix> output) const;
+
+    const MatrixMap &getAValues() const {
+        return a_values;
+    }
+
+    const Shape &getOutputShape() const {
+        return convolved_output.dimensions();
+    }
+
+    Eigen::Index getInputSize() const {
+        return prev_a_values.size();
+    }
+
+    Eigen::Index getOutputSize() const {
+        return convolved_output.size();
+    }
+
+    const Shape &getInputShape() const {
+        return input_shape;
+    }
+
+    const Shape &getFilterShape() const {
+        return filter_shape;
+    }
+
+    const Filters &getFilters() const {
+        return filters;
+    }
+
+    activation getActivation() const {
+        return activ_type;
+    }
+
+    precision getPrecision() const {
+        return activ_precision;
+    }
+
+    // exact (the default), fast or fastest exp/tanh in the activation, for the filters as well
+    void set_precision(precision accuracy);
+
+    void set_optimizer(const OptimizerConfig &config);
+
     void apply_back_prop(double learning_rate);
 
+    // Data-parallel training (see DataParallelConfig): the replicas stop at calc_back_prop, the model
+    // sums their gradients and updates the filters through parameter_blocks
+    void begin_update();
+
+    std::vector<ParameterBlock<Scalar>> parameter_blocks();
+
     void print_structure();
 };
 
 
-template<size_t ConvLDimension>
-Eigen::Tensor<double, ConvLDimension> ConvLayer<ConvLDimension>::convolve(const Filter<ConvLDimension> &filter) {
+template<size_t ConvLDimension, typename Scalar>
+Eigen::Tensor<Scalar, ConvLDimension>
+ConvLayer<ConvLDimension, Scalar>::convolve(const Filter<ConvLDimension, Scalar> &filter) {
     return filter.convolve(prev_a_values);
 }
 
-template<size_t ConvLDimension>
-ConvLayer<ConvLDimension>::ConvLayer(const size_t n_filters, const Shape filter_shape, activation activ_func,
-                                     const Shape input_shape) {
+template<size_t ConvLDimension, typename Scalar>
+ConvLayer<ConvLDimension, Scalar>::ConvLayer(const size_t n_filters, const Shape filter_shape, activation activ_func,
+                                             const Shape input_shape) {
 
     {
         check_correct(no_zeros(filter_shape));
@@ -75,13 +183,17 @@ ConvLayer<ConvLDimension>::ConvLayer(const size_t n_filters, const Shape filter_
     this->filter_shape = filter_shape;
 
     filters.reserve(n_filters);
-    dK_grads.reserve(n_filters);
-    dB_grads.reserve(n_filters);
+    dK_grads.resize(n_filters, ConvLT(filter_shape));
+    dB_grads.resize(n_filters);
+    rotated_kernels.resize(n_filters, ConvLT(filter_shape));
 
+    this->input_shape = input_shape;
     prev_a_values.resize(input_shape);
 
+    activ_type = activ_func;
+
     for (size_t i = 0; i < n_filters; ++i) {
-        filters.emplace_back(Filter<ConvLDimension>(filter_shape, activ_func));
+        filters.emplace_back(Filter<ConvLDimension, Scalar>(filter_shape, activ_func));
     }
 
     Shape convolved_shape = input_shape;
@@ -91,13 +203,21 @@ ConvLayer<ConvLDimension>::ConvLayer(const size_t n_filters, const Shape filter_
     }
 
     one_convolved_shape = convolved_shape;
+    delta_piece.resize(one_convolved_shape);
+
+    Shape padded_shape;
+    for (size_t i = 0; i < ConvLDimension; ++i) {
+        padding_offsets[i] = filter_shape[i] - 1;
+        padded_shape[i] = one_convolved_shape[i] + 2 * padding_offsets[i];
+    }
+    padded_delta.resize(padded_shape);
 
     convolved_shape[ConvLDimension - 1] *= n_filters;
     convolved_output.resize(convolved_shape);
 }
 
-template<size_t ConvLDimension>
-Eigen::Tensor<double, ConvLDimension> &ConvLayer<ConvLDimension>::forward_prop(const ConvLT &input) {
+template<size_t ConvLDimension, typename Scalar>
+Eigen::Tensor<Scalar, ConvLDimension> &ConvLayer<ConvLDimension, Scalar>::forward_prop(const ConvLT &input) {
     if (!(last_step_done == ConvSTEPS::NOTHING || last_step_done == ConvSTEPS::APPLY_BACKPROP)) {
         throw std::runtime_error("ConvLayer::forward_prop: last step is not done");
     }
@@ -115,7 +235,7 @@ Eigen::Tensor<double, ConvLDimension> &ConvLayer<ConvLDimension>::forward_prop(c
 
     for (const auto &filter: filters) {
         conv_res = convolve(filter);
-        convolved_output.slice(to_combine_start, one_convolved_shape) = conv_res;
+        convolved_output.slice(to_combine_start, one_convolved_shape).device(execution::device()) = conv_res;
         to_combine_start[ConvLDimension - 1] += dim_increment;
     }
 
@@ -123,8 +243,8 @@ Eigen::Tensor<double, ConvLDimension> &ConvLayer<ConvLDimension>::forward_prop(c
     return convolved_output;
 }
 
-template<size_t ConvLDimension>
-Eigen::Tensor<double, ConvLDimension> ConvLayer<ConvLDimension>::calc_back_prop(const ConvLT &delta) {
+template<size_t ConvLDimension, typename Scalar>
+Eigen::Tensor<Scalar, ConvLDimension> ConvLayer<ConvLDimension, Scalar>::calc_back_prop(const ConvLT &delta) {
     if (last_step_done != ConvSTEPS::FORWARD) {
         throw std::runtime_error("ConvLayer::calc_back_prop: forward_prop must be called before calc_back_prop");
     }
@@ -132,7 +252,8 @@ Eigen::Tensor<double, ConvLDimension> ConvLayer<ConvLDimension>::calc_back_prop(
     ConvLT dX;
     dX.resize(prev_a_values.dimensions());
     dX.setZero();
-    Eigen::Tensor<double, 0> intermediate_sum;
+    Eigen::Tensor<Scalar, 0> intermediate_sum;
+    const auto &device = execution::device();
 
     auto to_separate_start = one_convolved_shape;
     auto dim_increment = one_convolved_shape[ConvLDimension - 1];
@@ -145,32 +266,37 @@ Eigen::Tensor<double, ConvLDimension> ConvLayer<ConvLDimension>::calc_back_prop(
     Eigen::array<std::pair<Eigen::Index, Eigen::Index>, ConvLDimension> paddings;
     // TODO: understand why there is a coefficient 2 here
     // 2*pad - filter + 1 = 0 ~ same convolution => pad = (filter - 1) / 2
+    Shape dZ_padded_shape;
     for (int i = 0; i < ConvLDimension; ++i) {
         padding_sizes[i] = filter_shape[i] - 1;
         paddings[i] = std::make_pair(padding_sizes[i], padding_sizes[i]);
+        dZ_padded_shape[i] = one_convolved_shape[i] + 2 * padding_sizes[i];
     }
 
     for (size_t i = 0; i < filters.size(); ++i) {
         // the gradient marks are used as in scientific notations or amateur videos on YT
-        const Filter<ConvLDimension> &filter = filters[i];
+        const Filter<ConvLDimension, Scalar> &filter = filters[i];
 
 
-        ConvLT delta_piece = delta.slice(to_separate_start, one_convolved_shape);
+        ConvLT delta_piece(one_convolved_shape);
+        delta_piece.device(device) = delta.slice(to_separate_start, one_convolved_shape);
 
-        ConvLT dO_dZ = filter.activation_derivative(delta_piece);
+        // the derivative is taken from this filter's activated output
+        ConvLT dO_dZ = filter.activation_derivative(convolved_output.slice(to_separate_start, one_convolved_shape));
 
         // TODO: check the formula
         ConvLT dZ = delta_piece * dO_dZ;
 
 
-        dK_grads[i] = prev_a_values.convolve(dZ, dims_to_convolve);
+        dK_grads[i].device(device) = prev_a_values.convolve(dZ, dims_to_convolve);
         intermediate_sum = dZ.sum();
         dB_grads[i] = intermediate_sum();
 
 
         ConvLT rotated_filter_weights = filter.rotate_filter();
-        ConvLT dZ_padded = dZ.pad(paddings, 0);
-        dX += dZ_padded.convolve(rotated_filter_weights, dims_to_convolve);
+        ConvLT dZ_padded(dZ_padded_shape);
+        dZ_padded.device(device) = dZ.pad(paddings, 0);
+        dX.device(device) += dZ_padded.convolve(rotated_filter_weights, dims_to_convolve);
         to_separate_start[ConvLDimension - 1] += dim_increment;
 
 //#ifdef DEBUG
@@ -186,25 +312,186 @@ Eigen::Tensor<double, ConvLDimension> ConvLayer<ConvLDimension>::calc_back_prop(
     }
 
     last_step_done = ConvSTEPS::CALC_BACKPROP;
-    return dX * (1. / filters.size());
+    return dX * static_cast<Scalar>(1. / filters.size());
+}
+
+
+template<size_t ConvLDimension, typename Scalar>
+void ConvLayer<ConvLDimension, Scalar>::reserve_workspace(const Eigen::Index batch_size) {
+    const Eigen::Index outputs = convolved_output.size() * batch_size;
+    const Eigen::Index saved = saved_size(batch_size);
+    Scalar *memory = storage.allocate(saved + 2 * outputs + prev_a_values.size() * batch_size);
+    bind_views(batch_size, memory, memory + saved, memory + saved + outputs, memory + saved + 2 * outputs);
+}
+
+template<size_t ConvLDimension, typename Scalar>
+void ConvLayer<ConvLDimension, Scalar>::bind_workspace(const Eigen::Index batch_size, Scalar *saved, Scalar *a,
+                                                       Scalar *delta_buffer, Scalar *gradient) {
+    storage.release();
+    bind_views(batch_size, saved, a, delta_buffer, gradient);
+}
+
+template<size_t ConvLDimension, typename Scalar>
+void ConvLayer<ConvLDimension, Scalar>::bind_views(const Eigen::Index batch_size, Scalar *saved, Scalar *a,
+                                                   Scalar *delta_buffer, Scalar *gradient) {
+    relu_mask.reset(saved);
+    a_values.reset(a, convolved_output.size(), batch_size);
+    delta.reset(delta_buffer, convolved_output.size(), batch_size);
+    input_gradient.reset(gradient, prev_a_values.size(), batch_size);
+}
+
+template<size_t ConvLDimension, typename Scalar>
+void ConvLayer<ConvLDimension, Scalar>::convolve_sample(const Scalar *input, Scalar *output) const {
+    Eigen::TensorMap<const ConvLT> in(input, input_shape);
+    Eigen::TensorMap<ConvLT> out(output, convolved_output.dimensions());
+
+    Shape start{};
+    for (const auto &filter: filters) {
+        // the convolution keeps its kernel argument by value: through a map it is not copied
+        Eigen::TensorMap<const ConvLT> kernel(filter.get_kernel().data(), filter_shape);
+        out.slice(start, one_convolved_shape).device(execution::device()) =
+                in.convolve(kernel, dims_to_convolve) + filter.get_bias();
+        start[ConvLDimension - 1] += one_convolved_shape[ConvLDimension - 1];
+    }
+}
+
+template<size_t ConvLDimension, typename Scalar>
+const MatrixMapT<Scalar> &ConvLayer<ConvLDimension, Scalar>::forward_prop(const ConstRef &input) {
+    if (input.cols() != a_values.cols()) {
+        reserve_workspace(input.cols());
+    }
+    // activated in place while the sample is still in cache, ReLU records its mask meanwhile
+    act::dispatch(activ_type, activ_precision, [&](auto policy) {
+        for (Eigen::Index s = 0; s < input.cols(); ++s) {
+            auto output = a_values.col(s);
+            convolve_sample(input.col(s).data(), output.data());
+            if (saves_mask()) {
+                relu_mask.forward(s * a_values.rows(), output.data(), output.data(), a_values.rows());
+            } else {
+                act::activate<decltype(policy)>(output);
+            }
+        }
+    });
+
+    last_step_done = ConvSTEPS::FORWARD;
+    return a_values;
+}
+
+template<size_t ConvLDimension, typename Scalar>
+const MatrixMapT<Scalar> &
+ConvLayer<ConvLDimension, Scalar>::calc_back_prop(const ConstRef &gradient, const ConstRef &input, const bool propagate) {
+    if (saves_mask()) {
+        for (Eigen::Index s = 0; s < delta.cols(); ++s) {
+            relu_mask.backward(s * delta.rows(), gradient.col(s).data(), delta.col(s).data(), delta.rows());
+        }
+    } else {
+        act::dispatch(activ_type, [&](auto policy) {
+            delta.array() = decltype(policy)::derivative(a_values.array()) * gradient.array();
+        });
+    }
+
+    // the tensor expressions are spread over the thread budget coefficient by coefficient, the sums stay
+    // on this thread: the gradients do not depend on the number of threads
+    const auto &device = execution::device();
+    Eigen::array<bool, ConvLDimension> flip_all;
+    flip_all.fill(true);
+    for (size_t f = 0; f < filters.size(); ++f) {
+        dK_grads[f].setZero();
+        dB_grads[f] = 0;
+        rotated_kernels[f].device(device) = filters[f].get_kernel().reverse(flip_all);
+    }
+    if (propagate) {
+        input_gradient.setZero();
+        padded_delta.setZero();
+    }
+
+    for (Eigen::Index s = 0; s < input.cols(); ++s) {
+        Eigen::TensorMap<const ConvLT> in(input.col(s).data(), input_shape);
+        Eigen::TensorMap<const ConvLT> d(delta.col(s).data(), convolved_output.dimensions());
+        // without `propagate` the gradient buffer may not be bound at all
+        Eigen::TensorMap<ConvLT> dX(propagate ? input_gradient.col(s).data() : nullptr, input_shape);
+
+        Shape start{};
+        for (size_t f = 0; f < filters.size(); ++f) {
+            delta_piece.device(device) = d.slice(start, one_convolved_shape);
+            dK_grads[f].device(device) += in.convolve(Eigen::TensorMap<const ConvLT>(delta_piece.data(), one_convolved_shape),
+                                       dims_to_convolve);
+            dB_grads[f] += Eigen::Map<const Vector>(delta_piece.data(), delta_piece.size()).sum();
+
+            if (propagate) {
+                // full convolution: only the interior of padded_delta is rewritten, the border stays zero
+                padded_delta.slice(padding_offsets, one_convolved_shape).device(device) = delta_piece;
+                dX.device(device) += padded_delta.convolve(Eigen::TensorMap<const ConvLT>(rotated_kernels[f].data(), filter_shape),
+                                            dims_to_convolve);
+            }
+            start[ConvLDimension - 1] += one_convolved_shape[ConvLDimension - 1];
+        }
+    }
+
+    const auto inv_m = static_cast<Scalar>(1. / static_cast<double>(input.cols()));
+    for (size_t f = 0; f < filters.size(); ++f) {
+        dK_grads[f] = dK_grads[f] * inv_m;
+        dB_grads[f] *= inv_m;
+    }
+
+    last_step_done = ConvSTEPS::CALC_BACKPROP;
+    return input_gradient;
+}
+
+template<size_t ConvLDimension, typename Scalar>
+void ConvLayer<ConvLDimension, Scalar>::infer(const Eigen::Ref<const Matrix> &input, Eigen::Ref<Matrix> output) const {
+    for (Eigen::Index s = 0; s < input.cols(); ++s) {
+        convolve_sample(input.col(s).data(), output.col(s).data());
+    }
+    act::dispatch(activ_type, activ_precision, [&](auto policy) { act::activate<decltype(policy)>(output); });
 }
 
+template<size_t ConvLDimension, typename Scalar>
+void ConvLayer<ConvLDimension, Scalar>::set_precision(const precision accuracy) {
+    activ_precision = accuracy;
+    for (auto &filter: filters) {
+        filter.set_precision(accuracy);
+    }
+}
+
+template<size_t ConvLDimension, typename Scalar>
+void ConvLayer<ConvLDimension, Scalar>::set_optimizer(const OptimizerConfig &config) {
+    optimizer = Optimizer<Scalar>(config);
+    for (auto &filter: filters) {
+        filter.reset_optimizer_state();
+    }
+}
 
-template<size_t ConvLDimension>
-void ConvLayer<ConvLDimension>::apply_back_prop(const double learning_rate) {
+template<size_t ConvLDimension, typename Scalar>
+void ConvLayer<ConvLDimension, Scalar>::apply_back_prop(const double learning_rate) {
     if (last_step_done != ConvSTEPS::CALC_BACKPROP) {
         throw std::runtime_error("ConvLayer::apply_back_prop: calc_back_prop must be called before apply_back_prop");
     }
 
+    optimizer.begin_step();
     for (size_t i = 0; i < filters.size(); ++i) {
-        filters[i].update_weights(dK_grads[i], dB_grads[i], learning_rate);
+        filters[i].update_weights(dK_grads[i], dB_grads[i], learning_rate, optimizer);
     }
 
     last_step_done = ConvSTEPS::APPLY_BACKPROP;
 }
 
-template<size_t ConvLDimension>
-void ConvLayer<ConvLDimension>::print_structure() {
+template<size_t ConvLDimension, typename Scalar>
+void ConvLayer<ConvLDimension, Scalar>::begin_update() {
+    optimizer.begin_step();
+}
+
+template<size_t ConvLDimension, typename Scalar>
+std::vector<ParameterBlock<Scalar>> ConvLayer<ConvLDimension, Scalar>::parameter_blocks() {
+    std::vector<ParameterBlock<Scalar>> blocks;
+    for (size_t f = 0; f < filters.size(); ++f) {
+        filters[f].append_parameter_blocks(dK_grads[f], dB_grads[f], optimizer, blocks);
+    }
+    return blocks;
+}
+
+template<size_t ConvLDimension, typename Scalar>
+void ConvLayer<ConvLDimension, Scalar>::print_structure() {
     auto line = [](const auto &s) { std::cout << s << "\n"; };
 
     line("Number of filters: " + std::to_string(filters.size()));
@@ -4,10 +4,17 @@
 
 #include "Convolutions.h"
 
-Convolutional3D::Convolutional3D(const size_t n_filters, const Shape filters_shape, activation activ_func,
-                                 const Shape input_shape) : ConvLayer<DIMENSION>(n_filters, filters_shape, activ_func,
-                                                                                 input_shape) {}
+template<typename Scalar>
+Convolutional3D<Scalar>::Convolutional3D(const size_t n_filters, const Shape filters_shape, activation activ_func,
+                                         const Shape input_shape) : ConvLayer<3, Scalar>(n_filters, filters_shape,
+                                                                                         activ_func, input_shape) {}
 
-Convolutional2D::Convolutional2D(const size_t n_filters, const Shape filters_shape, activation activ_func,
-                                 const Shape input_shape) : ConvLayer<DIMENSION>(n_filters, filters_shape, activ_func,
-                                                                                 input_shape) {}
+template<typename Scalar>
+Convolutional2D<Scalar>::Convolutional2D(const size_t n_filters, const Shape filters_shape, activation activ_func,
+                                         const Shape input_shape) : ConvLayer<2, Scalar>(n_filters, filters_shape,
+                                                                                         activ_func, input_shape) {}
+
+template class Convolutional3D<float>;
+template class Convolutional3D<double>;
+template class Convolutional2D<float>;
+template class Convolutional2D<double>;
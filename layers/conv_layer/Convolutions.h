@@ -7,13 +7,17 @@
 
 #include "ConvLayerBase.h"
 
-class Convolutional3D : public ConvLayer<3> {
+template<typename Scalar = double>
+class Convolutional3D : public ConvLayer<3, Scalar> {
+    using Shape = typename ConvLayer<3, Scalar>::Shape;
 public:
     explicit Convolutional3D(size_t n_filters, Shape filters_shape, activation activ_func, Shape input_shape);
 };
 
 
-class Convolutional2D : public ConvLayer<2> {
+template<typename Scalar = double>
+class Convolutional2D : public ConvLayer<2, Scalar> {
+    using Shape = typename ConvLayer<2, Scalar>::Shape;
 public:
     explicit Convolutional2D(size_t n_filters, Shape filters_shape, activation activ_func, Shape input_shape);
 };
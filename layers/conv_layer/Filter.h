@@ -5,32 +5,42 @@
 #ifndef DEEPDENDRO_FILTER_H
 #define DEEPDENDRO_FILTER_H
 
+#include <vector>
 #include <unsupported/Eigen/CXX11/Tensor>
 
-#include "activationDerivative.h"
-#include "activ_func_conv.h"
+#include "activationFuncs.h"
 #include "common_funcs.h"
 #include "Pooling.h"
+#include "Optimizer.h"
+#include "execution_context.h"
 
-template<size_t KernelDimension>
-using ActivFunc = Eigen::Tensor<double, KernelDimension> (*)(const Eigen::Tensor<double, KernelDimension> &);
-
-template<size_t KernelDimension>
+template<size_t KernelDimension, typename Scalar = double>
 class Filter {
-    using KernelT = Eigen::Tensor<double, KernelDimension>;
+    using KernelT = Eigen::Tensor<Scalar, KernelDimension>;
     using Shape = Eigen::array<Eigen::Index, KernelDimension>;
 
     Shape filter_shape;
     KernelT kernel_weights{};
-    double bias{};
+    Scalar bias{};
+    OptimizerSlot<Scalar> kernel_state;
+    OptimizerSlot<Scalar> bias_state;
 
     Eigen::array<ptrdiff_t, KernelDimension> dims_to_convolve;
 
-    ActivFunc<KernelDimension> activation_func;
-    ActivFunc<KernelDimension> activation_func_derivative;
+    activation activ_type = activation::relu;
+    precision activ_precision = precision::exact;
 
     Eigen::array<int, KernelDimension> flip_order;
 
+    // a valid convolution of `input` with the kernel
+    Shape output_shape(const KernelT &input) const {
+        Shape shape = input.dimensions();
+        for (size_t i = 0; i < KernelDimension; ++i) {
+            shape[i] -= filter_shape[i] - 1;
+        }
+        return shape;
+    }
+
 public:
 
     Filter() = default;
@@ -42,30 +52,62 @@ public:
         return kernel_weights;
     }
 
+    const KernelT &get_kernel() const {
+        return kernel_weights;
+    }
+
+    Scalar get_bias() const {
+        return bias;
+    }
+
     KernelT convolve(const KernelT &input) const {
-        KernelT res = input.convolve(kernel_weights, dims_to_convolve) + bias;
-        return activation_func(res);
+        KernelT res(output_shape(input));
+        res.device(execution::device()) = input.convolve(kernel_weights, dims_to_convolve) + bias;
+        act::dispatch(activ_type, activ_precision, [&](auto policy) { act::activate<decltype(policy)>(res); });
+        return res;
     }
 
-    void update_weights(const KernelT &dK, double dB, double lr) {
-        kernel_weights -= lr * dK;
-        bias -= lr * dB;
+    // the step itself (begin_step) is counted by the owning layer, the state lives here
+    void update_weights(const KernelT &dK, Scalar dB, double lr, const Optimizer<Scalar> &optimizer) {
+        optimizer.update(kernel_weights.data(), dK.data(), kernel_weights.size(), kernel_state, lr, true);
+        optimizer.update(&bias, &dB, 1, bias_state, lr, false);
+    }
+
+    // the kernel and the bias as blocks updated from outside, with dK and dB as their gradients
+    void append_parameter_blocks(KernelT &dK, Scalar &dB, const Optimizer<Scalar> &optimizer,
+                                 std::vector<ParameterBlock<Scalar>> &blocks) {
+        optimizer.prepare_slot(kernel_state, kernel_weights.size());
+        optimizer.prepare_slot(bias_state, 1);
+        blocks.push_back({kernel_weights.data(), dK.data(), kernel_weights.size(), &optimizer, &kernel_state, true,
+                          nullptr});
+        blocks.push_back({&bias, &dB, 1, &optimizer, &bias_state, false, nullptr});
+    }
+
+    void set_precision(const precision accuracy) {
+        activ_precision = accuracy;
+    }
+
+    void reset_optimizer_state() {
+        kernel_state = {};
+        bias_state = {};
     }
 
     KernelT rotate_filter() const;
 
-    KernelT activation_derivative(const KernelT &activated) const {
-        return activation_func_derivative(activated);
+    // from the output of convolve(), not from the pre-activation
+    template<typename Activated>
+    KernelT activation_derivative(const Activated &activated) const {
+        return act::dispatch(activ_type, [&](auto policy) { return KernelT(decltype(policy)::derivative(activated)); });
     }
 
 
 };
 
 
-template<size_t KernelDimension>
-Filter<KernelDimension>::Filter(Shape filter_shape,
-                                activation activation_func) :
-        filter_shape(filter_shape) {
+template<size_t KernelDimension, typename Scalar>
+Filter<KernelDimension, Scalar>::Filter(Shape filter_shape,
+                                        activation activation_func) :
+        filter_shape(filter_shape), activ_type(activation_func) {
 
     {
         check_correct(no_zeros(filter_shape));
@@ -82,18 +124,18 @@ Filter<KernelDimension>::Filter(Shape filter_shape,
     flip_order[KernelDimension - 1] = 0;
 
 
-    // TODO: change for all activation functions
-    this->activation_func = Tensor_ReLU<KernelDimension>;
-    this->activation_func_derivative = Tensor_ReLU_Derivative<KernelDimension>;
-
+    // same scaling as the dense layers: uniform in [-1, 1] (setRandom gives [0, 1)), times sqrt(2 / fan_in)
     kernel_weights.resize(filter_shape);
     kernel_weights.setRandom();
+    const auto scale = static_cast<Scalar>(std::sqrt(2. / static_cast<double>(kernel_weights.size())));
+    kernel_weights = (kernel_weights * Scalar(2) - Scalar(1)) * scale;
 }
 
-template<size_t KernelDimension>
-Eigen::Tensor<double, KernelDimension> Filter<KernelDimension>::rotate_filter() const {
+template<size_t KernelDimension, typename Scalar>
+Eigen::Tensor<Scalar, KernelDimension> Filter<KernelDimension, Scalar>::rotate_filter() const {
     // by 180 degrees, first two dimensions
-    Eigen::Tensor<double, KernelDimension> rotated_filter = kernel_weights.reverse(flip_order);
+    Eigen::Tensor<Scalar, KernelDimension> rotated_filter(filter_shape);
+    rotated_filter.device(execution::device()) = kernel_weights.reverse(flip_order);
     return rotated_filter;
 }
 
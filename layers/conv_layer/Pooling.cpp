@@ -4,15 +4,16 @@
 
 #include "Pooling.h"
 
-void MaxPool3D::pool3D(const KernelT &input) {
-    double max_val, val;
+template<typename Scalar>
+void MaxPool3D<Scalar>::pool3D(const KernelT &input) {
+    Scalar max_val, val;
 
     for (Eigen::Index i = 0; i < this->output_shape[0]; ++i) {
         for (Eigen::Index j = 0; j < this->output_shape[1]; ++j) {
             for (Eigen::Index k = 0; k < this->output_shape[2]; ++k) {
                 Eigen::DSizes<Eigen::Index, 3> start(i * this->stride[0], j * this->stride[1], k * this->stride[2]);
 
-                max_val = -std::numeric_limits<double>::infinity();
+                max_val = -std::numeric_limits<Scalar>::infinity();
                 for (Eigen::Index di = 0; di < this->grid_size[0]; ++di) {
                     for (Eigen::Index dj = 0; dj < this->grid_size[1]; ++dj) {
                         for (Eigen::Index dk = 0; dk < this->grid_size[2]; ++dk) {
@@ -27,15 +28,16 @@ void MaxPool3D::pool3D(const KernelT &input) {
     }
 }
 
-MaxPool3D::KernelT
-MaxPool3D::calc_back_prop(const KernelT &before_pool, const KernelT &after_pool, const KernelT &delta_piece) {
+template<typename Scalar>
+typename MaxPool3D<Scalar>::KernelT
+MaxPool3D<Scalar>::calc_back_prop(const KernelT &before_pool, const KernelT &after_pool, const KernelT &delta_piece) {
     check_correct(this->output_shape.at(0) == after_pool.dimension(0) &&
                   this->output_shape.at(1) == after_pool.dimension(1) &&
                   this->output_shape.at(2) == after_pool.dimension(2));
 
-    dC.setZero();
+    this->dC.setZero();
 
-    double max_val;
+    Scalar max_val;
     for (Eigen::Index i = 0; i < this->output_shape[0]; ++i) {
         for (Eigen::Index j = 0; j < this->output_shape[1]; ++j) {
             for (Eigen::Index k = 0; k < this->output_shape[2]; ++k) {
@@ -46,7 +48,7 @@ MaxPool3D::calc_back_prop(const KernelT &before_pool, const KernelT &after_pool,
                         for (Eigen::Index dk = 0; dk < this->grid_size[2]; ++dk) {
                             Eigen::DSizes<Eigen::Index, 3> idx(start[0] + di, start[1] + dj, start[2] + dk);
                             if (before_pool(idx[0], idx[1], idx[2]) == max_val) {
-                                dC(idx[0], idx[1], idx[2]) = delta_piece(i, j, k);
+                                this->dC(idx[0], idx[1], idx[2]) = delta_piece(i, j, k);
                             }
                         }
                     }
@@ -54,18 +56,112 @@ MaxPool3D::calc_back_prop(const KernelT &before_pool, const KernelT &after_pool,
             }
         }
     }
-    return dC;
+    return this->dC;
 }
 
+template<typename Scalar>
+template<typename T>
+void MaxPool3D<Scalar>::pool_sample(const T *input, T *out, Eigen::Index *argmax) const {
+    const Eigen::Index rows = this->input_shape[0];
+    const Eigen::Index plane = rows * this->input_shape[1];
+    Eigen::Index o = 0;
 
-void MaxPool2D::pool2D(const KernelT &input) {
-    double max_val, val;
+    // column-major order, the same as the flattened tensors
+    for (Eigen::Index k = 0; k < this->output_shape[2]; ++k) {
+        const Eigen::Index k_end = std::min(k * this->stride[2] + this->grid_size[2], this->input_shape[2]);
+        for (Eigen::Index j = 0; j < this->output_shape[1]; ++j) {
+            const Eigen::Index j_end = std::min(j * this->stride[1] + this->grid_size[1], this->input_shape[1]);
+            for (Eigen::Index i = 0; i < this->output_shape[0]; ++i, ++o) {
+                const Eigen::Index i_end = std::min(i * this->stride[0] + this->grid_size[0], rows);
+
+                T max_val = std::numeric_limits<T>::has_infinity ? -std::numeric_limits<T>::infinity()
+                                                                 : std::numeric_limits<T>::lowest();
+                Eigen::Index max_idx = 0;
+                for (Eigen::Index dk = k * this->stride[2]; dk < k_end; ++dk) {
+                    for (Eigen::Index dj = j * this->stride[1]; dj < j_end; ++dj) {
+                        for (Eigen::Index di = i * this->stride[0]; di < i_end; ++di) {
+                            const Eigen::Index idx = di + rows * dj + plane * dk;
+                            if (input[idx] > max_val) {
+                                max_val = input[idx];
+                                max_idx = idx;
+                            }
+                        }
+                    }
+                }
+                out[o] = max_val;
+                if (argmax != nullptr) {
+                    argmax[o] = max_idx;
+                }
+            }
+        }
+    }
+}
+
+template<typename Scalar>
+void MaxPool3D<Scalar>::reserve_workspace(const Eigen::Index batch_size) {
+    const Eigen::Index outputs = this->output.size() * batch_size;
+    Scalar *memory = storage.allocate(outputs + this->dC.size() * batch_size);
+    a_values.reset(memory, this->output.size(), batch_size);
+    input_gradient.reset(memory + outputs, this->dC.size(), batch_size);
+    switches.resize(this->output.size(), batch_size);
+}
+
+template<typename Scalar>
+void MaxPool3D<Scalar>::bind_workspace(const Eigen::Index batch_size, Scalar *a, Scalar *gradient) {
+    storage.release();
+    a_values.reset(a, this->output.size(), batch_size);
+    input_gradient.reset(gradient, this->dC.size(), batch_size);
+    // only grown: a shorter batch (the last one of an epoch) uses the first columns
+    if (switches.rows() != this->output.size() || switches.cols() < batch_size) {
+        switches.resize(this->output.size(), batch_size);
+    }
+}
+
+template<typename Scalar>
+const MatrixMapT<Scalar> &MaxPool3D<Scalar>::forward_prop(const ConstRef &input) {
+    if (input.cols() != a_values.cols()) {
+        reserve_workspace(input.cols());
+    }
+    for (Eigen::Index s = 0; s < input.cols(); ++s) {
+        pool_sample(input.col(s).data(), a_values.col(s).data(), switches.col(s).data());
+    }
+    return a_values;
+}
+
+template<typename Scalar>
+const MatrixMapT<Scalar> &MaxPool3D<Scalar>::calc_back_prop(const ConstRef &gradient) {
+    // overlapping windows may pick the same input twice, so the gradients are accumulated
+    input_gradient.setZero();
+    for (Eigen::Index s = 0; s < gradient.cols(); ++s) {
+        for (Eigen::Index o = 0; o < gradient.rows(); ++o) {
+            input_gradient(switches(o, s), s) += gradient(o, s);
+        }
+    }
+    return input_gradient;
+}
+
+template<typename Scalar>
+void MaxPool3D<Scalar>::infer(const Eigen::Ref<const Matrix> &input, Eigen::Ref<Matrix> output) const {
+    for (Eigen::Index s = 0; s < input.cols(); ++s) {
+        pool_sample(input.col(s).data(), output.col(s).data(), nullptr);
+    }
+}
+
+template<typename Scalar>
+void MaxPool3D<Scalar>::infer_sample(const std::int8_t *input, std::int8_t *output) const {
+    pool_sample(input, output, nullptr);
+}
+
+
+template<typename Scalar>
+void MaxPool2D<Scalar>::pool2D(const KernelT &input) {
+    Scalar max_val, val;
 
     for (Eigen::Index i = 0; i < this->output_shape[0]; ++i) {
         for (Eigen::Index j = 0; j < this->output_shape[1]; ++j) {
             Eigen::DSizes<Eigen::Index, 2> start(i * this->stride[0], j * this->stride[1]);
 
-            max_val = -std::numeric_limits<double>::infinity();
+            max_val = -std::numeric_limits<Scalar>::infinity();
             for (Eigen::Index di = 0; di < this->grid_size[0]; ++di) {
                 for (Eigen::Index dj = 0; dj < this->grid_size[1]; ++dj) {
                     val = input(start[0] + di, start[1] + dj);
@@ -77,14 +173,15 @@ void MaxPool2D::pool2D(const KernelT &input) {
     }
 }
 
-MaxPool2D::KernelT
-MaxPool2D::calc_back_prop(const KernelT &before_pool, const KernelT &after_pool, const KernelT &delta_piece) {
+template<typename Scalar>
+typename MaxPool2D<Scalar>::KernelT
+MaxPool2D<Scalar>::calc_back_prop(const KernelT &before_pool, const KernelT &after_pool, const KernelT &delta_piece) {
     check_correct(this->output_shape.at(0) == after_pool.dimension(0) &&
                   this->output_shape.at(1) == after_pool.dimension(1));
 
-    dC.setZero();
+    this->dC.setZero();
 
-    double max_val;
+    Scalar max_val;
     for (Eigen::Index i = 0; i < this->output_shape[0]; ++i) {
         for (Eigen::Index j = 0; j < this->output_shape[1]; ++j) {
             Eigen::DSizes<Eigen::Index, 2> start(i * this->stride[0], j * this->stride[1]);
@@ -93,11 +190,16 @@ MaxPool2D::calc_back_prop(const KernelT &before_pool, const KernelT &after_pool,
                 for (Eigen::Index dj = 0; dj < this->grid_size[1]; ++dj) {
                     Eigen::DSizes<Eigen::Index, 2> idx(start[0] + di, start[1] + dj);
                     if (before_pool(idx[0], idx[1]) == max_val) {
-                        dC(idx[0], idx[1]) = delta_piece(i, j);
+                        this->dC(idx[0], idx[1]) = delta_piece(i, j);
                     }
                 }
             }
         }
     }
-    return dC;
+    return this->dC;
 }
+
+template class MaxPool3D<float>;
+template class MaxPool3D<double>;
+template class MaxPool2D<float>;
+template class MaxPool2D<double>;
@@ -6,22 +6,25 @@
 #define DEEPDENDRO_POOLING_H
 
 #include "cstddef"
+#include <cstdint>
 #include <unsupported/Eigen/CXX11/Tensor>
 #include <Eigen/Core>
 #include <Eigen/Dense>
 #include "common_funcs.h"
+#include "Layer.h"
 
 enum PoolType {
     MAX,
     AVG
 };
 
-template<size_t TensorDimension>
+template<size_t TensorDimension, typename Scalar = double>
 class MaxPoolingBase {
 protected:
-    using KernelT = Eigen::Tensor<double, TensorDimension>;
+    using KernelT = Eigen::Tensor<Scalar, TensorDimension>;
     using Shape = Eigen::array<Eigen::Index, TensorDimension>;
 
+    Shape input_shape;
     Shape grid_size;
     Shape stride;
     KernelT output;
@@ -38,11 +41,11 @@ public:
     }
 };
 
-template<size_t TensorDimension>
-MaxPoolingBase<TensorDimension>::MaxPoolingBase(Shape input_shape, Shape grid_size, Shape stride) : grid_size(
-        grid_size),
-                                                                                                    stride(stride),
-                                                                                                    output{} {
+template<size_t TensorDimension, typename Scalar>
+MaxPoolingBase<TensorDimension, Scalar>::MaxPoolingBase(Shape input_shape, Shape grid_size, Shape stride) : input_shape(
+        input_shape), grid_size(grid_size),
+                                                                                                            stride(stride),
+                                                                                                            output{} {
     {
         check_correct(no_zeros(grid_size));
         check_correct(no_zeros(stride));
@@ -63,31 +66,75 @@ MaxPoolingBase<TensorDimension>::MaxPoolingBase(Shape input_shape, Shape grid_si
     output.resize(output_shape);
 }
 
-class MaxPool3D : public MaxPoolingBase<3> {
+template<typename Scalar = double>
+class MaxPool3D : public MaxPoolingBase<3, Scalar> {
     const static size_t TensorDimension = 3;
-    using KernelT = Eigen::Tensor<double, TensorDimension>;
+    using KernelT = Eigen::Tensor<Scalar, TensorDimension>;
     using Shape = Eigen::array<Eigen::Index, TensorDimension>;
+    using Matrix = MatrixT<Scalar>;
+    using MatrixMap = MatrixMapT<Scalar>;
+    using ConstRef = Eigen::Ref<const Matrix>;
+
+    // batched path: every column is one sample's flattened tensor; switches holds, for every output,
+    // the flat input index of its maximum, so the backward pass is a scatter
+    BufferView<Scalar> a_values;
+    BufferView<Scalar> input_gradient;
+    WorkspaceStorage<Scalar> storage;
+    Eigen::Matrix<Eigen::Index, Eigen::Dynamic, Eigen::Dynamic> switches;
 
     void pool3D(const KernelT &input);
 
+    // argmax may be null (inference); T is Scalar, or int8 for a quantized model
+    template<typename T>
+    void pool_sample(const T *input, T *out, Eigen::Index *argmax) const;
+
 public:
     MaxPool3D(const Shape input_dims, const Shape grid_size,
               const Shape stride
     )
-            : MaxPoolingBase<TensorDimension>(input_dims, grid_size, stride) {}
+            : MaxPoolingBase<TensorDimension, Scalar>(input_dims, grid_size, stride) {}
 
     KernelT forward_prop(const KernelT &input) {
         pool3D(input);
-        return output;
+        return this->output;
     };
 
     KernelT calc_back_prop(const KernelT &before_pool, const KernelT &after_pool, const KernelT &delta_piece);
+
+    // Batched interface, used by Model: the samples are the columns of the matrices
+    void reserve_workspace(Eigen::Index batch_size);
+
+    // same, in memory owned by the caller: a of output size x batch_size, gradient of input size x batch_size
+    void bind_workspace(Eigen::Index batch_size, Scalar *a, Scalar *gradient);
+
+    const MatrixMap &forward_prop(const ConstRef &input);
+
+    const MatrixMap &calc_back_prop(const ConstRef &gradient);
+
+    // read-only forward pass for inference, output must not overlap input
+    void infer(const Eigen::Ref<const Matrix> &input, Eigen::Ref<Matrix> output) const;
+
+    // the same for one sample of a quantized model: the max commutes with the (positive) scale
+    void infer_sample(const std::int8_t *input, std::int8_t *output) const;
+
+    const MatrixMap &getAValues() const {
+        return a_values;
+    }
+
+    Eigen::Index getInputSize() const {
+        return this->dC.size();
+    }
+
+    Eigen::Index getOutputSize() const {
+        return this->output.size();
+    }
 };
 
 
-class MaxPool2D : public MaxPoolingBase<2> {
+template<typename Scalar = double>
+class MaxPool2D : public MaxPoolingBase<2, Scalar> {
     const static size_t TensorDimension = 2;
-    using KernelT = Eigen::Tensor<double, TensorDimension>;
+    using KernelT = Eigen::Tensor<Scalar, TensorDimension>;
     using Shape = Eigen::array<Eigen::Index, TensorDimension>;
 
     void pool2D(const KernelT &input);
@@ -96,11 +143,11 @@ public:
     MaxPool2D(const Shape input_dims, const Shape grid_size,
               const Shape stride
     )
-            : MaxPoolingBase<TensorDimension>(input_dims, grid_size, stride) {}
+            : MaxPoolingBase<TensorDimension, Scalar>(input_dims, grid_size, stride) {}
 
     KernelT forward_prop(const KernelT &input) {
         pool2D(input);
-        return output;
+        return this->output;
     };
 
     KernelT calc_back_prop(const KernelT &before_pool, const KernelT &after_pool, const KernelT &delta_piece);
@@ -9,8 +9,8 @@
 #include <unsupported/Eigen/CXX11/Tensor>
 #include <iostream>
 
-template<size_t Dimension>
-void traverseTensor(const Eigen::Tensor<double, Dimension> &tensor, const std::function<void()> &func) {
+template<size_t Dimension, typename Scalar = double>
+void traverseTensor(const Eigen::Tensor<Scalar, Dimension> &tensor, const std::function<void()> &func) {
     for (int i = 0; i < tensor.dimension(0); ++i) {
         const auto &subTensor = tensor.chip(i, 0);
         if (subTensor.dimensions() > 1) {
@@ -6,46 +6,54 @@
 #define DEEPDENDRO_FLATTENINGLAYER_H
 
 #include <unsupported/Eigen/CXX11/Tensor>
+#include "execution_context.h"
 
-template<size_t Dimension>
+template<size_t Dimension, typename Scalar = double>
 class FlatteningLayerBase {
     using Shape = Eigen::array<Eigen::Index, Dimension>;
+    using Vector = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+    using TensorT = Eigen::Tensor<Scalar, Dimension>;
 protected:
     Shape before_flattening_shape;
 public:
-    Eigen::VectorXd flatten(const Eigen::Tensor<double, Dimension> &tensor);
+    Vector flatten(const TensorT &tensor);
 
 
-    Eigen::Tensor<double, Dimension>
-    reshape(const Eigen::VectorXd &vec, const Eigen::array<Eigen::Index, Dimension> &shape);
+    TensorT
+    reshape(const Vector &vec, const Eigen::array<Eigen::Index, Dimension> &shape);
 
-    Eigen::Tensor<double, Dimension>
-    back_to_tensor(const Eigen::VectorXd &vec) {
+    TensorT
+    back_to_tensor(const Vector &vec) {
         return reshape(vec, before_flattening_shape);
     }
 
 };
 
-template<size_t Dimension>
-Eigen::VectorXd FlatteningLayerBase<Dimension>::flatten(const Eigen::Tensor<double, Dimension> &tensor) {
+template<size_t Dimension, typename Scalar>
+typename FlatteningLayerBase<Dimension, Scalar>::Vector
+FlatteningLayerBase<Dimension, Scalar>::flatten(const TensorT &tensor) {
     before_flattening_shape = tensor.dimensions();
 
-    Eigen::TensorMap<const Eigen::Tensor<double, 1>> flattened_tensor(tensor.data(), tensor.size());
-    Eigen::Map<const Eigen::VectorXd> vector(flattened_tensor.data(), tensor.size());
+    Eigen::TensorMap<const Eigen::Tensor<Scalar, 1>> flattened_tensor(tensor.data(), tensor.size());
+    Eigen::Map<const Vector> vector(flattened_tensor.data(), tensor.size());
     return vector;
 }
 
-template<size_t Dimension>
-Eigen::Tensor<double, Dimension> FlatteningLayerBase<Dimension>::reshape(const Eigen::VectorXd &vec,
-                                                                         const Eigen::array<Eigen::Index, Dimension> &shape) {
-    Eigen::TensorMap<const Eigen::Tensor<double, 1>> tensor_map(vec.data(), vec.size());
-    return tensor_map.reshape(shape);
+template<size_t Dimension, typename Scalar>
+typename FlatteningLayerBase<Dimension, Scalar>::TensorT
+FlatteningLayerBase<Dimension, Scalar>::reshape(const Vector &vec, const Eigen::array<Eigen::Index, Dimension> &shape) {
+    Eigen::TensorMap<const Eigen::Tensor<Scalar, 1>> tensor_map(vec.data(), vec.size());
+    TensorT result(shape);
+    result.device(execution::device()) = tensor_map.reshape(shape);
+    return result;
 }
 
-class FlatteningLayer2D : public FlatteningLayerBase<2> {
+template<typename Scalar = double>
+class FlatteningLayer2D : public FlatteningLayerBase<2, Scalar> {
 };
 
-class FlatteningLayer3D : public FlatteningLayerBase<3> {
+template<typename Scalar = double>
+class FlatteningLayer3D : public FlatteningLayerBase<3, Scalar> {
 };
 
 
@@ -0,0 +1,155 @@
+#ifndef DEEPDENDRO_GEMMWORKSPACE_H
+#define DEEPDENDRO_GEMMWORKSPACE_H
+
+#include <Eigen/Dense>
+#include <memory>
+#include "execution_context.h"
+
+// Eigen's `dst.noalias() = A * B` allocates its packing buffers on every call once they
+// exceed EIGEN_STACK_ALLOCATION_LIMIT, which is the case for any realistic layer.
+// GemmWorkspace keeps those buffers alive between calls, so a reserved product
+// does no heap allocations. The result is accumulated: dst += alpha * op(A) * op(B).
+//
+// LhsOrder / RhsOrder select the storage order the operands are read with:
+// reading a column-major matrix as RowMajor multiplies by its transpose without copying it.
+//
+// With a thread budget (execution::set_threads) and OpenMP, a product is split between the threads as
+// Eigen splits its own. That path keeps its own blocking, built for the thread count and the reserved
+// dimensions and rebuilt only when either changes; the shared lhs buffer lives in it, but each thread
+// still packs its rhs panel in a buffer of Eigen's, which is heap-allocated above the stack limit.
+template<typename Scalar, int LhsOrder = Eigen::ColMajor, int RhsOrder = Eigen::ColMajor>
+class GemmWorkspace {
+    using Matrix = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+    using Blocking = Eigen::internal::gemm_blocking_space<Eigen::ColMajor, Scalar, Scalar,
+            Eigen::Dynamic, Eigen::Dynamic, Eigen::Dynamic>;
+    using Product = Eigen::internal::general_matrix_matrix_product<Eigen::Index,
+            Scalar, LhsOrder, false, Scalar, RhsOrder, false, Eigen::ColMajor, 1>;
+
+    std::unique_ptr<Blocking> blocking;
+    // blocking of the parallel path, for parallel_threads threads
+    std::unique_ptr<Blocking> parallel_blocking;
+    Eigen::Index parallel_threads = 0;
+    // the buffers are sized for products up to max_rows x max_cols x max_depth; depth is the inner
+    // dimension of the products run now
+    Eigen::Index max_rows = 0, max_cols = 0, max_depth = 0, depth = 0;
+
+    // grows the reserved dimensions to cover the product; false if they already did
+    bool cover(const Eigen::Index rows, const Eigen::Index cols, const Eigen::Index inner) {
+        if (rows <= max_rows && cols <= max_cols && inner <= max_depth) {
+            return false;
+        }
+        max_rows = std::max(rows, max_rows);
+        max_cols = std::max(cols, max_cols);
+        max_depth = std::max(inner, max_depth);
+        return true;
+    }
+
+    // the parallel blocking for the current thread budget, sized for the reserved dimensions: the lhs
+    // buffer holds every row of a depth panel, which smaller products use a part of
+    Blocking &reserve_parallel(const Eigen::Index rows, const Eigen::Index cols) {
+        const Eigen::Index threads = Eigen::nbThreads();
+        if (cover(rows, cols, depth)) {
+            blocking.reset();
+            parallel_blocking.reset();
+        }
+        if (!parallel_blocking || parallel_threads != threads) {
+            parallel_blocking = std::make_unique<Blocking>(max_rows, max_cols, max_depth, threads, true);
+            parallel_blocking->initParallel(max_rows, max_cols, max_depth, threads);
+            // B too: a product too small to split runs on one thread with this blocking
+            parallel_blocking->allocateAll();
+            parallel_threads = threads;
+        }
+        return *parallel_blocking;
+    }
+
+    // the interface of Eigen's gemm_functor, which parallelize_gemm calls once per thread
+    struct ParallelProduct {
+        using Traits = Eigen::internal::gebp_traits<Scalar, Scalar>;
+        Eigen::Index rows, cols, depth;
+        const Scalar *lhs;
+        Eigen::Index lhs_stride;
+        const Scalar *rhs;
+        Eigen::Index rhs_stride;
+        Scalar *dst;
+        Eigen::Index dst_stride;
+        Scalar alpha;
+        Blocking &blocking;
+
+        // the blocking was initialized for the parallel products by reserve_parallel
+        void initParallelSession(Eigen::Index) const {
+            blocking.allocateA();
+        }
+
+        void operator()(const Eigen::Index row, const Eigen::Index n_rows, const Eigen::Index col = 0,
+                        Eigen::Index n_cols = -1, Eigen::internal::GemmParallelInfo<Eigen::Index> *info = nullptr) const {
+            if (n_cols == -1) {
+                n_cols = cols;
+            }
+            const Scalar *lhs_block = LhsOrder == Eigen::ColMajor ? lhs + row : lhs + row * lhs_stride;
+            const Scalar *rhs_block = RhsOrder == Eigen::ColMajor ? rhs + col * rhs_stride : rhs + col;
+            Product::run(n_rows, n_cols, depth, lhs_block, lhs_stride, rhs_block, rhs_stride,
+                         dst + row + col * dst_stride, 1, dst_stride, alpha, blocking, info);
+        }
+    };
+
+public:
+    GemmWorkspace() = default;
+
+    // the packing buffers are never shared, a copy reserves its own
+    GemmWorkspace(const GemmWorkspace &other) {
+        reserve(other.max_rows, other.max_cols, other.max_depth);
+        depth = other.depth;
+    }
+
+    GemmWorkspace &operator=(const GemmWorkspace &other) {
+        if (this != &other) {
+            reserve(other.max_rows, other.max_cols, other.max_depth);
+            depth = other.depth;
+        }
+        return *this;
+    }
+
+    GemmWorkspace(GemmWorkspace &&) noexcept = default;
+
+    GemmWorkspace &operator=(GemmWorkspace &&) noexcept = default;
+
+    // the products that follow have the given inner dimension; products of at most rows x cols will not
+    // allocate. A smaller inner dimension than reserved before keeps the buffers (the last, short batch
+    // of an epoch does not reallocate them twice).
+    void reserve(Eigen::Index rows, Eigen::Index cols, Eigen::Index inner) {
+        depth = inner;
+        const bool grown = cover(rows, cols, inner);
+        if (grown) {
+            parallel_blocking.reset();
+        } else if (blocking) {
+            return;
+        }
+        blocking.reset();
+        if (rows == 0 || cols == 0 || inner == 0) {
+            return;
+        }
+        blocking = std::make_unique<Blocking>(max_rows, max_cols, max_depth, 1, true);
+        blocking->allocateAll();
+    }
+
+    // dst += alpha * op(lhs) * op(rhs), where op() reads the operand in LhsOrder / RhsOrder
+    void run(Eigen::Index rows, Eigen::Index cols, const Scalar *lhs, Eigen::Index lhs_stride,
+             const Scalar *rhs, Eigen::Index rhs_stride, Scalar *dst, Eigen::Index dst_stride, Scalar alpha) {
+        if (execution::parallel_allowed() && Eigen::nbThreads() > 1) {
+            Eigen::internal::parallelize_gemm<true>(
+                    ParallelProduct{rows, cols, depth, lhs, lhs_stride, rhs, rhs_stride, dst, dst_stride, alpha,
+                                    reserve_parallel(rows, cols)}, rows, cols, depth, false);
+            return;
+        }
+        reserve(rows, cols, depth);
+        Product::run(rows, cols, depth, lhs, lhs_stride, rhs, rhs_stride,
+                     dst, 1, dst_stride, alpha, *blocking);
+    }
+
+    void run(Eigen::Index rows, Eigen::Index cols, const Scalar *lhs, Eigen::Index lhs_stride,
+             const Scalar *rhs, Eigen::Index rhs_stride, Eigen::Ref<Matrix> dst, Scalar alpha) {
+        run(rows, cols, lhs, lhs_stride, rhs, rhs_stride, dst.data(), dst.outerStride(), alpha);
+    }
+};
+
+#endif //DEEPDENDRO_GEMMWORKSPACE_H
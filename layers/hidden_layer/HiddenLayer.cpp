@@ -3,48 +3,295 @@
 //
 
 #include "HiddenLayer.h"
+#include <algorithm>
+#include <numeric>
+#include <vector>
 
-HiddenLayer::HiddenLayer(const int curr_neurons, MShape input_shape, activation type) :
-        biases{VectorXd::Zero(curr_neurons)},
-        weights{MatrixXd::Random(curr_neurons, input_shape.first)},
-        a_values{MatrixXd::Zero(curr_neurons, input_shape.second)} {
+template<typename Scalar>
+HiddenLayer<Scalar>::HiddenLayer(const int curr_neurons, MShape input_shape, activation type) :
+        biases{Vector::Zero(curr_neurons)},
+        weights{Matrix::Random(curr_neurons, input_shape.first)},
+        activ_type{type} {
 
-    auto [activFunc, activDer] = find_activation_func_DENSE(type);
-    activ_func = activFunc; activ_func_derivative = activDer;
-
-    weights *= sqrt(2 / static_cast<double>(input_shape.first));
+    weights *= static_cast<Scalar>(sqrt(2 / static_cast<double>(input_shape.first)));
     shape.first = curr_neurons;
     shape.second = input_shape.second;
 }
 
+template<typename Scalar>
+void HiddenLayer<Scalar>::reserve_workspace(const Eigen::Index batch_size) {
+    const Eigen::Index activations = weights.rows() * batch_size;
+    const Eigen::Index saved = saved_size(batch_size);
+    Scalar *memory = storage.allocate(saved + 2 * activations + weights.cols() * batch_size);
+    point_views(batch_size, memory, memory + saved, memory + saved + activations, memory + saved + 2 * activations);
+}
 
-void HiddenLayer::forward_prop(const MatrixXd &prev_a_values) {
-    z_values = weights * prev_a_values;
-    z_values.colwise() += biases;
-    a_values = activ_func(z_values);
+template<typename Scalar>
+void HiddenLayer<Scalar>::bind_workspace(const Eigen::Index batch_size, Scalar *saved, Scalar *a, Scalar *delta_buffer,
+                                         Scalar *gradient) {
+    storage.release();
+    point_views(batch_size, saved, a, delta_buffer, gradient);
 }
 
-inline MatrixXd HiddenLayer::calc_gradient() {
-    return weights.transpose() * delta;
+template<typename Scalar>
+bool HiddenLayer<Scalar>::saves_mask() const {
+    return activ_type == activation::relu;
 }
 
-MatrixXd HiddenLayer::calc_first_back_prop(const MatrixXd &labels) {
-    delta = a_values - labels;
-    return calc_gradient();
+template<typename Scalar>
+Eigen::Index HiddenLayer<Scalar>::saved_size(const Eigen::Index batch_size) const {
+    return saves_mask() ? ReluMask<Scalar>::scalars_for(weights.rows() * batch_size) : 0;
+}
+
+template<typename Scalar>
+void HiddenLayer<Scalar>::point_views(const Eigen::Index batch_size, Scalar *saved, Scalar *a, Scalar *delta_buffer,
+                                      Scalar *gradient) {
+    const Eigen::Index neurons = weights.rows();
+    relu_mask.reset(saved);
+    a_values.reset(a, neurons, batch_size);
+    delta.reset(delta_buffer, neurons, batch_size);
+    prev_gradient.reset(gradient, weights.cols(), batch_size);
+    reserve_gemms(batch_size);
+}
+
+template<typename Scalar>
+void HiddenLayer<Scalar>::reserve_gemms(const Eigen::Index batch_size) {
+    const Eigen::Index neurons = weights.rows();
+    const Eigen::Index inputs = weights.cols();
+
+    // an output panel should stay in L2 between the product and the epilogue,
+    // but be wide enough that repacking the weights for every panel stays cheap
+    const auto panel_bytes = static_cast<Eigen::Index>(Eigen::l2CacheSize());
+    forward_panel = std::max<Eigen::Index>(512, panel_bytes / static_cast<Eigen::Index>(sizeof(Scalar) * neurons));
+    forward_panel = std::min(forward_panel, batch_size);
+
+    forward_gemm.reserve(neurons, forward_panel, inputs);
+    gradient_gemm.reserve(inputs, batch_size, neurons);
+    update_gemm.reserve(neurons, inputs, batch_size);
+}
+
+
+template<typename Scalar>
+void HiddenLayer<Scalar>::forward_prop(const ConstRef &prev_a_values) {
+    forward_panels(prev_a_values, true);
+}
+
+template<typename Scalar>
+void HiddenLayer<Scalar>::forward_prop_logits(const ConstRef &prev_a_values) {
+    forward_panels(prev_a_values, false);
 }
 
-MatrixXd HiddenLayer::calc_back_prop(const MatrixXd &gradient) {
-    MatrixXd relu_derivative = activ_func_derivative(z_values);
-    delta = gradient.cwiseProduct(relu_derivative);
+template<typename Scalar>
+void HiddenLayer<Scalar>::forward_panels(const ConstRef &prev_a_values, const bool activate) {
+    if (prev_a_values.cols() != a_values.cols()) {
+        reserve_workspace(prev_a_values.cols());
+    }
+    // fused kernel: for every panel of columns the biases initialize the output, the product is
+    // accumulated on top of them and the activation is applied in place while the panel is still in cache;
+    // ReLU records its mask meanwhile
+    const Eigen::Index cols = prev_a_values.cols();
+    for (Eigen::Index start = 0; start < cols; start += forward_panel) {
+        const Eigen::Index width = std::min(forward_panel, cols - start);
+        auto panel = a_values.middleCols(start, width);
+
+        panel.colwise() = biases;
+        forward_gemm.run(weights.rows(), width, weights.data(), weights.outerStride(),
+                         prev_a_values.col(start).data(), prev_a_values.outerStride(),
+                         panel.data(), a_values.outerStride(), Scalar(1));
+        if (!activate) {
+            continue;
+        }
+        if (saves_mask()) {
+            relu_mask.forward(start * a_values.rows(), panel.data(), panel.data(), panel.size());
+        } else {
+            act::dispatch(activ_type, activ_precision, [&](auto policy) { act::activate<decltype(policy)>(panel); });
+        }
+    }
+}
+
+template<typename Scalar>
+const MatrixMapT<Scalar> &HiddenLayer<Scalar>::calc_gradient() {
+    // weights^T * delta, the transpose is read in place
+    prev_gradient.setZero();
+    gradient_gemm.run(weights.cols(), delta.cols(), weights.data(), weights.outerStride(),
+                      delta.data(), delta.outerStride(), prev_gradient, Scalar(1));
+    return prev_gradient;
+}
+
+template<typename Scalar>
+void HiddenLayer<Scalar>::calc_first_back_prop(const ConstRef &labels) {
+    last_loss = lossFunc::softmaxCrossEntropy<Scalar>(a_values, labels, a_values, delta);
+}
+
+template<typename Scalar>
+void HiddenLayer<Scalar>::calc_delta(const ConstRef &gradient) {
+    if (saves_mask()) {
+        const Eigen::Index rows = delta.rows();
+        for (Eigen::Index c = 0; c < delta.cols(); ++c) {
+            relu_mask.backward(c * rows, gradient.col(c).data(), delta.col(c).data(), rows);
+        }
+        return;
+    }
+    act::dispatch(activ_type, [&](auto policy) {
+        delta.array() = decltype(policy)::derivative(a_values.array()) * gradient.array();
+    });
+}
+
+template<typename Scalar>
+const MatrixMapT<Scalar> &HiddenLayer<Scalar>::calc_back_prop(const ConstRef &gradient) {
+    calc_delta(gradient);
     return calc_gradient();
 }
 
-void HiddenLayer::apply_back_prop(double learning_rate, const MatrixXd &prev_a_values) {
+template<typename Scalar>
+void HiddenLayer<Scalar>::set_precision(const precision accuracy) {
+    activ_precision = accuracy;
+}
+
+template<typename Scalar>
+void HiddenLayer<Scalar>::set_optimizer(const OptimizerConfig &config) {
+    optimizer = Optimizer<Scalar>(config);
+    if (optimizer.is_plain_sgd()) {
+        weights_state = {};
+        biases_state = {};
+        weights_gradient.resize(0, 0);
+        biases_gradient.resize(0);
+        return;
+    }
+    optimizer.init_slot(weights_state, weights.size());
+    optimizer.init_slot(biases_state, biases.size());
+    weights_gradient.resize(weights.rows(), weights.cols());
+    biases_gradient.resize(biases.size());
+}
+
+template<typename Scalar>
+void HiddenLayer<Scalar>::apply_back_prop(double learning_rate, const ConstRef &prev_a_values) {
     auto m = static_cast<double> (delta.cols());
-    weights -= learning_rate * (1. / m) * delta * prev_a_values.transpose();
-    biases -= learning_rate * (1. / m) * delta.rowwise().sum();
+    if (optimizer.is_plain_sgd()) {
+        const auto step = static_cast<Scalar>(learning_rate * (1. / m));
+        // weights -= step * delta * prev_a_values^T, accumulated straight into the weights
+        update_gemm.run(weights.rows(), weights.cols(), delta.data(), delta.outerStride(),
+                        prev_a_values.data(), prev_a_values.outerStride(), weights, -step);
+        biases.noalias() -= step * delta.rowwise().sum();
+    } else {
+        calc_param_gradient(prev_a_values);
+        optimizer.begin_step();
+        optimizer.update(weights.data(), weights_gradient.data(), weights.size(), weights_state, learning_rate, true);
+        optimizer.update(biases.data(), biases_gradient.data(), biases.size(), biases_state, learning_rate, false);
+    }
+    if (prune_mask.size() != 0) {
+        weights.array() *= prune_mask.array();
+    }
 }
 
-const MatrixXd &HiddenLayer::getAValues() {
+template<typename Scalar>
+void HiddenLayer<Scalar>::calc_param_gradient(const ConstRef &prev_a_values) {
+    const auto inv_m = static_cast<Scalar>(1. / static_cast<double>(delta.cols()));
+    weights_gradient.setZero(weights.rows(), weights.cols());
+    update_gemm.run(weights.rows(), weights.cols(), delta.data(), delta.outerStride(),
+                    prev_a_values.data(), prev_a_values.outerStride(), weights_gradient, inv_m);
+    biases_gradient.noalias() = inv_m * delta.rowwise().sum();
+}
+
+template<typename Scalar>
+void HiddenLayer<Scalar>::begin_update() {
+    optimizer.begin_step();
+}
+
+template<typename Scalar>
+std::vector<ParameterBlock<Scalar>> HiddenLayer<Scalar>::parameter_blocks() {
+    weights_gradient.resize(weights.rows(), weights.cols());
+    biases_gradient.resize(biases.size());
+    optimizer.prepare_slot(weights_state, weights.size());
+    optimizer.prepare_slot(biases_state, biases.size());
+    return {{weights.data(), weights_gradient.data(), weights.size(), &optimizer, &weights_state, true,
+             prune_mask.size() != 0 ? prune_mask.data() : nullptr},
+            {biases.data(), biases_gradient.data(), biases.size(), &optimizer, &biases_state, false, nullptr}};
+}
+
+template<typename Scalar>
+void HiddenLayer<Scalar>::prune(const double sparsity, const Eigen::Index block_rows) {
+    const Eigen::Index rows = weights.rows();
+    const Eigen::Index blocks_per_column = (rows + block_rows - 1) / block_rows;
+    const Eigen::Index n_blocks = blocks_per_column * weights.cols();
+    const auto n_pruned = static_cast<Eigen::Index>(std::clamp(sparsity, 0., 1.) * static_cast<double>(n_blocks));
+    if (prune_mask.size() == 0) {
+        prune_mask = Matrix::Ones(rows, weights.cols());
+    }
+    if (n_pruned == 0) {
+        return;
+    }
+
+    auto block = [&](const Eigen::Index b) {
+        const Eigen::Index first = b % blocks_per_column * block_rows;
+        return weights.col(b / blocks_per_column).segment(first, std::min(block_rows, rows - first));
+    };
+    Vector scores(n_blocks);
+    for (Eigen::Index b = 0; b < n_blocks; ++b) {
+        scores(b) = block(b).cwiseAbs().sum();
+    }
+    std::vector<Eigen::Index> order(n_blocks);
+    std::iota(order.begin(), order.end(), Eigen::Index(0));
+    std::nth_element(order.begin(), order.begin() + (n_pruned - 1), order.end(),
+                     [&scores](const Eigen::Index a, const Eigen::Index b) { return scores(a) < scores(b); });
+    for (Eigen::Index k = 0; k < n_pruned; ++k) {
+        const Eigen::Index b = order[k];
+        const Eigen::Index first = b % blocks_per_column * block_rows;
+        prune_mask.col(b / blocks_per_column).segment(first, std::min(block_rows, rows - first)).setZero();
+    }
+    weights.array() *= prune_mask.array();
+}
+
+template<typename Scalar>
+double HiddenLayer<Scalar>::getSparsity() const {
+    return static_cast<double>((weights.array() == Scalar(0)).count()) / static_cast<double>(weights.size());
+}
+
+template<typename Scalar>
+void HiddenLayer<Scalar>::infer(const Eigen::Ref<const Matrix> &input, Eigen::Ref<Matrix> output,
+                                GemmWorkspace<Scalar> &gemm, const bool activate) const {
+    output.colwise() = biases;
+    gemm.run(weights.rows(), input.cols(), weights.data(), weights.outerStride(),
+             input.data(), input.outerStride(), output.data(), output.outerStride(), Scalar(1));
+    if (activate) {
+        act::dispatch(activ_type, activ_precision, [&](auto policy) { act::activate<decltype(policy)>(output); });
+    }
+}
+
+template<typename Scalar>
+const MatrixMapT<Scalar> &HiddenLayer<Scalar>::getAValues() const {
     return a_values;
 }
+
+template<typename Scalar>
+Scalar HiddenLayer<Scalar>::getLoss() const {
+    return last_loss;
+}
+
+template<typename Scalar>
+activation HiddenLayer<Scalar>::getActivation() const {
+    return activ_type;
+}
+
+template<typename Scalar>
+precision HiddenLayer<Scalar>::getPrecision() const {
+    return activ_precision;
+}
+
+template<typename Scalar>
+Eigen::Index HiddenLayer<Scalar>::getInputSize() const {
+    return weights.cols();
+}
+
+template<typename Scalar>
+const MatrixT<Scalar> &HiddenLayer<Scalar>::getWeights() const {
+    return weights;
+}
+
+template<typename Scalar>
+const VectorT<Scalar> &HiddenLayer<Scalar>::getBiases() const {
+    return biases;
+}
+
+template class HiddenLayer<float>;
+template class HiddenLayer<double>;
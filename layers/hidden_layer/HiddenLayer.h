@@ -5,35 +5,142 @@
 #ifndef DEEPDENDRO_HIDDENLAYER_H
 #define DEEPDENDRO_HIDDENLAYER_H
 
-#include "activationDerivative.h"
+#include "activationFuncs.h"
+#include "GemmWorkspace.h"
 #include "Layer.h"
+#include "lossFunc.h"
+#include "Optimizer.h"
 #include "iostream"
 
+template<typename Scalar = double>
 class HiddenLayer : public Layer {
-    MatrixXd weights;
-    VectorXd biases;
-    MatrixXd z_values;
-    MatrixXd a_values;
-    MatrixXd delta;
+    using Matrix = MatrixT<Scalar>;
+    using Vector = VectorT<Scalar>;
+    using MatrixMap = MatrixMapT<Scalar>;
+    using ConstRef = Eigen::Ref<const Matrix>;
 
-    ActivationFunc<MatrixXd> activ_func;
-    ActivationFunc<MatrixXd> activ_func_derivative;
+    Matrix weights;
+    Vector biases;
+    // Training buffers: views into `storage`, or into a model's planned arena (bind_workspace).
+    // There are no pre-activations: the activation is applied in place in a_values, and the backward pass
+    // takes its derivative from a_values, or from a bit mask for ReLU (a_values is overwritten by then).
+    // The output layer leaves its logits in a_values for the loss head to turn into probabilities.
+    ReluMask<Scalar> relu_mask;
+    BufferView<Scalar> a_values;
+    BufferView<Scalar> delta;
+    // gradient w.r.t. the previous layer's activations, handed to it by calc_back_prop
+    BufferView<Scalar> prev_gradient;
+    WorkspaceStorage<Scalar> storage;
+
+    // preallocated packing buffers for the three products of a training step
+    GemmWorkspace<Scalar> forward_gemm;
+    GemmWorkspace<Scalar, Eigen::RowMajor, Eigen::ColMajor> gradient_gemm;
+    GemmWorkspace<Scalar, Eigen::ColMajor, Eigen::RowMajor> update_gemm;
+    // number of output columns computed and activated together in forward_prop
+    Eigen::Index forward_panel = 0;
+    // the gradients are only materialized when the optimizer is not plain SGD
+    Optimizer<Scalar> optimizer;
+    OptimizerSlot<Scalar> weights_state;
+    OptimizerSlot<Scalar> biases_state;
+    Matrix weights_gradient;
+    Vector biases_gradient;
+    // 1 for the weights kept by magnitude pruning, 0 for the pruned ones; empty until the first prune()
+    Matrix prune_mask;
+    // mean loss of the last batch, computed by the fused output head
+    Scalar last_loss = 0;
+
+    activation activ_type;
+    precision activ_precision = precision::exact;
 
 public:
     MShape shape;
     HiddenLayer(int curr_neurons, MShape prev_shape, activation type);
 
-    void forward_prop(const MatrixXd &prev_a_values);
+    // sizes every buffer of a training step for batches of up to batch_size columns, in the layer's own memory;
+    // after this, forward/backward/update with that batch size do no heap allocations, as long as the
+    // products run on one thread (see GemmWorkspace)
+    void reserve_workspace(Eigen::Index batch_size);
+
+    // same, but the buffers are placed in memory owned by the caller (the model's arena): `saved` of
+    // saved_size(batch_size), a and delta of neurons x batch_size, gradient of inputs x batch_size;
+    // a null gradient is never computed
+    void bind_workspace(Eigen::Index batch_size, Scalar *saved, Scalar *a, Scalar *delta_buffer, Scalar *gradient);
+
+    // true for ReLU layers, which keep a bit mask from forward to backward; the others need their
+    // a_values until their backward pass instead
+    bool saves_mask() const;
+
+    // Scalars kept from the forward pass for the backward one besides a_values: the ReLU mask, or nothing
+    Eigen::Index saved_size(Eigen::Index batch_size) const;
+
+    void forward_prop(const ConstRef &prev_a_values);
+
+    // for the softmax output layer in training: only biases + product into a_values, the softmax itself
+    // is computed in place together with the loss and delta in calc_first_back_prop
+    void forward_prop_logits(const ConstRef &prev_a_values);
+
+    // gradient w.r.t. the input, from delta
+    const MatrixMap &calc_gradient();
+
+    // fused softmax + cross-entropy head: one pass over the logits fills a_values, delta and the loss
+    void calc_first_back_prop(const ConstRef &labels);
+
+    void calc_delta(const ConstRef &gradient);
+
+    const MatrixMap &calc_back_prop(const ConstRef &gradient);
+
+    // exact (the default), fast or fastest exp/tanh in the activation, see approxMath.h
+    void set_precision(precision accuracy);
+
+    // resets the optimizer state; plain SGD (the default) needs no extra memory
+    void set_optimizer(const OptimizerConfig &config);
+
+    void apply_back_prop(double learning_rate, const ConstRef &prev_a_values);
+
+    // Data-parallel training (see DataParallelConfig): a replica only computes the mean gradients of its
+    // batch, the model sums them over the replicas and updates the parameters through parameter_blocks
+    void calc_param_gradient(const ConstRef &prev_a_values);
+
+    // counts the optimizer step of an update made through parameter_blocks
+    void begin_update();
+
+    // weights and biases, with gradient buffers and optimizer state sized for an update
+    std::vector<ParameterBlock<Scalar>> parameter_blocks();
+
+    // zeroes the smallest weights until `sparsity` of them are zero, in blocks of block_rows neurons for
+    // one input ranked by summed magnitude; they stay zero through later updates. Already pruned
+    // weights rank lowest, so a growing sparsity only ever prunes more.
+    void prune(double sparsity, Eigen::Index block_rows = 1);
+
+    // fraction of the weights that are exactly zero
+    double getSparsity() const;
+
+    // read-only forward pass for inference: touches no training state, so it is safe to call
+    // from several threads at once. output must not overlap input.
+    // Without `activate` the raw biases + product are returned (e.g. logits of a softmax layer).
+    void infer(const Eigen::Ref<const Matrix> &input, Eigen::Ref<Matrix> output,
+               GemmWorkspace<Scalar> &gemm, bool activate = true) const;
+
+    const MatrixMap &getAValues() const;
+
+    Scalar getLoss() const;
+
+    activation getActivation() const;
+
+    precision getPrecision() const;
+
+    Eigen::Index getInputSize() const;
 
-    MatrixXd calc_gradient();
+    const Matrix &getWeights() const;
 
-    MatrixXd calc_first_back_prop(const MatrixXd &labels);
+    const Vector &getBiases() const;
 
-    MatrixXd calc_back_prop(const MatrixXd &gradient);
+private:
+    void forward_panels(const ConstRef &prev_a_values, bool activate);
 
-    void apply_back_prop(double learning_rate, const MatrixXd &prev_a_values);
+    void point_views(Eigen::Index batch_size, Scalar *saved, Scalar *a, Scalar *delta_buffer, Scalar *gradient);
 
-    const MatrixXd &getAValues();
+    void reserve_gemms(Eigen::Index batch_size);
 };
 
 #endif //DEEPDENDRO_HIDDENLAYER_H
@@ -0,0 +1,209 @@
+#ifndef DEEPDENDRO_INT8GEMM_H
+#define DEEPDENDRO_INT8GEMM_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <Eigen/Core>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Integer kernels of a quantized model: int8 operands, int32 sums, which are exact.
+// Every operand is a set of vectors read along the depth of the product (the rows of the weights,
+// the columns of the samples, the patches of a convolution), each of them `depth` bytes long and
+// padded with zeros to a multiple of depth_step, so the kernels have no remainder loop.
+namespace quantized {
+    constexpr Eigen::Index depth_step = 16;
+
+    inline Eigen::Index padded_depth(const Eigen::Index depth) {
+        return (depth + depth_step - 1) / depth_step * depth_step;
+    }
+
+    namespace detail {
+        constexpr int block_rows = 4;
+
+#if defined(__SSE2__)
+        inline std::int32_t horizontal_sum(__m128i x) {
+            x = _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2)));
+            x = _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)));
+            return _mm_cvtsi128_si32(x);
+        }
+#endif
+
+        // out[r] = a_r . b for R vectors a_r, `stride` bytes apart, b being loaded once for all of them.
+        // With SSSE3 and up, a_r . b = |b| . (a_r * sign(b)): pmaddubsw multiplies unsigned by signed bytes
+        // and adds pairs into 16 bits, which cannot saturate since every value is within [-127, 127]
+        // (127 * 127 * 2 < 2^15); AVX-512 VNNI / AVX-VNNI sum the products into 32 bits in one instruction.
+        // The widest available vectors go first, the narrower ones take the rest of the depth.
+        // Plain SSE2 widens both operands to 16 bits instead (pmaddwd).
+        template<int R>
+        inline void dot(const std::int8_t *a, const Eigen::Index stride, const std::int8_t *b,
+                        const Eigen::Index depth, std::int32_t *out) {
+#if defined(__SSSE3__)
+            __m128i sums[R];
+            for (int r = 0; r < R; ++r) {
+                sums[r] = _mm_setzero_si128();
+            }
+            const __m128i ones_128 = _mm_set1_epi16(1);
+            Eigen::Index k = 0;
+#if defined(__AVX2__)
+            __m256i wide_sums[R];
+            for (int r = 0; r < R; ++r) {
+                wide_sums[r] = _mm256_setzero_si256();
+            }
+            const __m256i ones = _mm256_set1_epi16(1);
+#if defined(__AVX512BW__)
+            // AVX-512 has no sign instruction: a_r is negated where b is negative by a masked subtraction
+            {
+                __m512i long_sums[R];
+                for (int r = 0; r < R; ++r) {
+                    long_sums[r] = _mm512_setzero_si512();
+                }
+                const __m512i zero = _mm512_setzero_si512();
+                for (; k + 4 * depth_step <= depth; k += 4 * depth_step) {
+                    const __m512i y = _mm512_loadu_si512(b + k);
+                    const __m512i y_abs = _mm512_abs_epi8(y);
+                    const __mmask64 negative = _mm512_movepi8_mask(y);
+                    for (int r = 0; r < R; ++r) {
+                        const __m512i x_in = _mm512_loadu_si512(a + r * stride + k);
+                        const __m512i x = _mm512_mask_sub_epi8(x_in, negative, zero, x_in);
+#if defined(__AVX512VNNI__)
+                        long_sums[r] = _mm512_dpbusd_epi32(long_sums[r], y_abs, x);
+#else
+                        long_sums[r] = _mm512_add_epi32(long_sums[r], _mm512_madd_epi16(
+                                _mm512_maddubs_epi16(y_abs, x), _mm512_set1_epi16(1)));
+#endif
+                    }
+                }
+                for (int r = 0; r < R; ++r) {
+                    wide_sums[r] = _mm256_add_epi32(_mm512_castsi512_si256(long_sums[r]),
+                                                    _mm512_extracti64x4_epi64(long_sums[r], 1));
+                }
+            }
+#endif
+            for (; k + 2 * depth_step <= depth; k += 2 * depth_step) {
+                const __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + k));
+                const __m256i y_abs = _mm256_abs_epi8(y);
+                for (int r = 0; r < R; ++r) {
+                    const __m256i x = _mm256_sign_epi8(
+                            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + r * stride + k)), y);
+#if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+                    wide_sums[r] = _mm256_dpbusd_epi32(wide_sums[r], y_abs, x);
+#elif defined(__AVXVNNI__)
+                    wide_sums[r] = _mm256_dpbusd_avx_epi32(wide_sums[r], y_abs, x);
+#else
+                    wide_sums[r] = _mm256_add_epi32(wide_sums[r],
+                                                    _mm256_madd_epi16(_mm256_maddubs_epi16(y_abs, x), ones));
+#endif
+                }
+            }
+            for (int r = 0; r < R; ++r) {
+                sums[r] = _mm_add_epi32(_mm256_castsi256_si128(wide_sums[r]),
+                                        _mm256_extracti128_si256(wide_sums[r], 1));
+            }
+#endif
+            for (; k < depth; k += depth_step) {
+                const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + k));
+                const __m128i y_abs = _mm_abs_epi8(y);
+                for (int r = 0; r < R; ++r) {
+                    const __m128i x = _mm_sign_epi8(
+                            _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + r * stride + k)), y);
+                    sums[r] = _mm_add_epi32(sums[r], _mm_madd_epi16(_mm_maddubs_epi16(y_abs, x), ones_128));
+                }
+            }
+            for (int r = 0; r < R; ++r) {
+                out[r] = horizontal_sum(sums[r]);
+            }
+#elif defined(__SSE2__)
+            // sign extension to 16 bits: the byte goes to the high half, then an arithmetic shift
+            auto widen_low = [](const __m128i v) { return _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8); };
+            auto widen_high = [](const __m128i v) { return _mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8); };
+            __m128i sums[R];
+            for (int r = 0; r < R; ++r) {
+                sums[r] = _mm_setzero_si128();
+            }
+            for (Eigen::Index k = 0; k < depth; k += depth_step) {
+                const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + k));
+                const __m128i y_low = widen_low(y), y_high = widen_high(y);
+                for (int r = 0; r < R; ++r) {
+                    const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + r * stride + k));
+                    sums[r] = _mm_add_epi32(sums[r], _mm_add_epi32(_mm_madd_epi16(widen_low(x), y_low),
+                                                                   _mm_madd_epi16(widen_high(x), y_high)));
+                }
+            }
+            for (int r = 0; r < R; ++r) {
+                out[r] = horizontal_sum(sums[r]);
+            }
+#else
+            for (int r = 0; r < R; ++r) {
+                std::int32_t sum = 0;
+                for (Eigen::Index k = 0; k < depth; ++k) {
+                    sum += static_cast<std::int16_t>(a[r * stride + k]) * static_cast<std::int16_t>(b[k]);
+                }
+                out[r] = sum;
+            }
+#endif
+        }
+    }
+
+    // q[i] = x[i] * inverse_scale rounded to nearest (even) and saturated to [-127, 127]; the clamp comes
+    // first so the conversion cannot overflow, the packs narrow 32 -> 16 -> 8 bits
+    template<typename Scalar>
+    inline void quantize(const Scalar *x, const Scalar inverse_scale, const Eigen::Index count, std::int8_t *q) {
+        Eigen::Index i = 0;
+#if defined(__SSE2__)
+        if constexpr (std::is_same_v<Scalar, float>) {
+            const __m128 scale = _mm_set1_ps(inverse_scale), low = _mm_set1_ps(-127.f), high = _mm_set1_ps(127.f);
+            auto convert = [&](const Eigen::Index at) {
+                return _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(x + at), scale), low), high));
+            };
+            for (; i + 16 <= count; i += 16) {
+                const __m128i words_low = _mm_packs_epi32(convert(i), convert(i + 4));
+                const __m128i words_high = _mm_packs_epi32(convert(i + 8), convert(i + 12));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(q + i), _mm_packs_epi16(words_low, words_high));
+            }
+        } else if constexpr (std::is_same_v<Scalar, double>) {
+            const __m128d scale = _mm_set1_pd(inverse_scale), low = _mm_set1_pd(-127.), high = _mm_set1_pd(127.);
+            auto convert = [&](const Eigen::Index at) {
+                auto two = [&](const Eigen::Index k) {
+                    return _mm_cvtpd_epi32(_mm_min_pd(_mm_max_pd(_mm_mul_pd(_mm_loadu_pd(x + k), scale), low), high));
+                };
+                return _mm_unpacklo_epi64(two(at), two(at + 2));
+            };
+            for (; i + 16 <= count; i += 16) {
+                const __m128i words_low = _mm_packs_epi32(convert(i), convert(i + 4));
+                const __m128i words_high = _mm_packs_epi32(convert(i + 8), convert(i + 12));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(q + i), _mm_packs_epi16(words_low, words_high));
+            }
+        }
+#endif
+        for (; i < count; ++i) {
+            q[i] = static_cast<std::int8_t>(std::nearbyint(std::clamp(x[i] * inverse_scale, Scalar(-127), Scalar(127))));
+        }
+    }
+
+    // c(i, j) = a_i . b_j for i < rows and j < cols, a_i starting at a + i * depth and b_j at b + j * depth;
+    // c is column-major with leading dimension ldc. A block of rows of a stays in L1 while the b_j
+    // stream past it.
+    inline void gemm(const Eigen::Index rows, const Eigen::Index cols, const Eigen::Index depth,
+                     const std::int8_t *a, const std::int8_t *b, std::int32_t *c, const Eigen::Index ldc) {
+        eigen_assert(depth % depth_step == 0);
+        Eigen::Index i = 0;
+        for (; i + detail::block_rows <= rows; i += detail::block_rows) {
+            for (Eigen::Index j = 0; j < cols; ++j) {
+                detail::dot<detail::block_rows>(a + i * depth, depth, b + j * depth, depth, c + i + j * ldc);
+            }
+        }
+        for (; i < rows; ++i) {
+            for (Eigen::Index j = 0; j < cols; ++j) {
+                detail::dot<1>(a + i * depth, depth, b + j * depth, depth, c + i + j * ldc);
+            }
+        }
+    }
+}
+
+
+#endif //DEEPDENDRO_INT8GEMM_H
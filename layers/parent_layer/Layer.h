@@ -8,11 +8,132 @@
 
 #include <Eigen/Dense>
 #include <cppad/cppad.hpp>
+#include <algorithm>
+#include <cstdint>
 
 
 using Eigen::MatrixXd;
 using Eigen::VectorXd;
 
+// every layer, loss and loader is templated on the scalar type, float and double are supported
+template<typename Scalar>
+using MatrixT = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+
+template<typename Scalar>
+using VectorT = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+
+template<typename Scalar>
+using MatrixMapT = Eigen::Map<MatrixT<Scalar>>;
+
+// A training buffer of a layer: a view either into the layer's own WorkspaceStorage or into a slice of
+// the arena planned by the model. A copied view is empty, so copies of a layer never write into the
+// buffers of the original; they reserve or bind their own before the next training step.
+// Assigning an expression writes into the viewed memory as for any Map.
+template<typename Scalar>
+class BufferView : public MatrixMapT<Scalar> {
+    using Base = MatrixMapT<Scalar>;
+public:
+    BufferView() : Base(nullptr, 0, 0) {}
+
+    BufferView(const BufferView &) : Base(nullptr, 0, 0) {}
+
+    BufferView &operator=(const BufferView &) {
+        reset(nullptr, 0, 0);
+        return *this;
+    }
+
+    using Base::operator=;
+
+    // a null data pointer gives an empty view
+    void reset(Scalar *data, Eigen::Index rows, Eigen::Index cols) {
+        if (data == nullptr) {
+            rows = cols = 0;
+        }
+        new(static_cast<Base *>(this)) Base(data, rows, cols);
+    }
+};
+
+// Memory a layer's BufferViews point into when no model arena is bound. Not copied with the layer.
+template<typename Scalar>
+class WorkspaceStorage {
+    VectorT<Scalar> data;
+public:
+    WorkspaceStorage() = default;
+
+    WorkspaceStorage(const WorkspaceStorage &) {}
+
+    WorkspaceStorage &operator=(const WorkspaceStorage &) {
+        data.resize(0);
+        return *this;
+    }
+
+    WorkspaceStorage(WorkspaceStorage &&) noexcept = default;
+
+    WorkspaceStorage &operator=(WorkspaceStorage &&) noexcept = default;
+
+    Scalar *allocate(Eigen::Index size) {
+        if (data.size() != size) {
+            data.resize(size);
+        }
+        return data.data();
+    }
+
+    void release() {
+        data.resize(0);
+    }
+};
+
+// What a ReLU layer keeps for its backward pass: one bit per element, set where the pre-activation was
+// positive, instead of the pre-activations themselves (64x smaller for double, 32x for float).
+// Elements are numbered in column-major order; the bits live in memory given by the layer, which may be
+// a slice of the model's arena, so the mask's size is expressed in Scalars.
+template<typename Scalar>
+class ReluMask {
+    std::uint64_t *words = nullptr;
+
+public:
+    static Eigen::Index scalars_for(const Eigen::Index elements) {
+        const Eigen::Index bytes = (elements + 63) / 64 * static_cast<Eigen::Index>(sizeof(std::uint64_t));
+        return (bytes + static_cast<Eigen::Index>(sizeof(Scalar)) - 1) / static_cast<Eigen::Index>(sizeof(Scalar));
+    }
+
+    void reset(Scalar *memory) {
+        words = reinterpret_cast<std::uint64_t *>(memory);
+    }
+
+    // a = max(z, 0) for the elements [begin, begin + count), recording which were positive.
+    // z and a point at element `begin` and may be the same buffer.
+    void forward(const Eigen::Index begin, const Scalar *z, Scalar *a, const Eigen::Index count) {
+        for (Eigen::Index i = 0; i < count;) {
+            const Eigen::Index bit = (begin + i) & 63;
+            const Eigen::Index n = std::min<Eigen::Index>(64 - bit, count - i);
+            std::uint64_t bits = 0;
+            for (Eigen::Index b = 0; b < n; ++b) {
+                const bool positive = z[i + b] > Scalar(0);
+                bits |= static_cast<std::uint64_t>(positive) << b;
+                a[i + b] = positive ? z[i + b] : Scalar(0);
+            }
+            std::uint64_t &word = words[(begin + i) >> 6];
+            const std::uint64_t field = n == 64 ? ~std::uint64_t(0) : ((std::uint64_t(1) << n) - 1) << bit;
+            word = (word & ~field) | (bits << bit);
+            i += n;
+        }
+    }
+
+    // the fused ReLU backward pass: delta = gradient where the bit is set, 0 elsewhere
+    void backward(const Eigen::Index begin, const Scalar *gradient, Scalar *delta, const Eigen::Index count) const {
+        for (Eigen::Index i = 0; i < count;) {
+            const Eigen::Index bit = (begin + i) & 63;
+            const Eigen::Index n = std::min<Eigen::Index>(64 - bit, count - i);
+            const std::uint64_t word = words[(begin + i) >> 6] >> bit;
+            for (Eigen::Index b = 0; b < n; ++b) {
+                delta[i + b] = (word >> b) & 1 ? gradient[i + b] : Scalar(0);
+            }
+            i += n;
+        }
+    }
+};
+
 
 typedef std::pair<size_t, size_t> MShape;
 
@@ -0,0 +1,151 @@
+#include "MetricsReporter.h"
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <optional>
+#include <unistd.h>
+#include "logging.h"
+
+MetricsReporter::MetricsReporter(const size_t epochs, const ReportOptions &options)
+        : channel(options.channel_capacity), options(options), epochs(epochs),
+          show_bar(isatty(fileno(stdout))) {
+    if (!options.log_path.empty()) {
+        log_file.open(options.log_path);
+        log = &log_file;
+    } else if (!show_bar) {
+        // no terminal to draw on: the log goes to stdout, buffered like a file
+        log = &std::cout;
+    }
+    if (log != nullptr && options.format == LogFormat::csv) {
+        *log << "kind,epoch,step,worker,loss,accuracy,samples\n";
+    }
+    worker = std::thread(&MetricsReporter::run, this);
+}
+
+MetricsReporter::~MetricsReporter() {
+    close();
+}
+
+void MetricsReporter::close() {
+    if (!worker.joinable()) {
+        return;
+    }
+    closing.store(true, std::memory_order_release);
+    worker.join();
+    if (dropped.load() > 0) {
+        std::cerr << "MetricsReporter: " << dropped.load() << " step events dropped (channel full), the epoch "
+                  << "summaries are complete" << std::endl;
+    }
+}
+
+void MetricsReporter::write(const char *kind, size_t epoch, size_t step, size_t worker, double loss,
+                            double accuracy, double samples) {
+    if (log == nullptr) {
+        return;
+    }
+    if (options.format == LogFormat::csv) {
+        *log << kind << ',' << epoch << ',' << step << ',' << worker << ',' << loss << ',' << accuracy << ','
+             << samples << '\n';
+    } else {
+        *log << R"({"kind":")" << kind << R"(","epoch":)" << epoch << R"(,"step":)" << step
+             << R"(,"worker":)" << worker << R"(,"loss":)" << loss << R"(,"accuracy":)" << accuracy << R"(,"samples":)" << samples << "}\n";
+    }
+}
+
+void MetricsReporter::handle(const MetricsEvent &event) {
+    if (event.kind == MetricsEvent::evaluation) {
+        last_eval_accuracy = event.correct / event.samples;
+        write("eval", event.epoch + 1, event.step, 0, 0, last_eval_accuracy, event.samples);
+        return;
+    }
+    if (event.kind == MetricsEvent::epoch_end) {
+        write("epoch", event.epoch + 1, 0, 0, event.loss, event.correct / event.samples, event.samples);
+        // the bar shows the complete figures until the next epoch's steps arrive
+        current_epoch = event.epoch;
+        epoch_loss = event.loss * event.samples;
+        epoch_correct = event.correct;
+        epoch_samples = event.samples;
+        return;
+    }
+    if (event.epoch != current_epoch) {
+        current_epoch = event.epoch;
+        epoch_loss = epoch_correct = epoch_samples = 0;
+    }
+    epoch_loss += event.loss * event.samples;
+    epoch_correct += event.correct;
+    epoch_samples += event.samples;
+    if (options.log_every_steps != 0 && event.step % options.log_every_steps == 0) {
+        write("step", event.epoch + 1, event.step, event.worker, event.loss, event.correct / event.samples,
+              event.samples);
+    }
+}
+
+void MetricsReporter::run() {
+    const std::string out_of_all = " / " + std::to_string(epochs) + " ";
+    std::optional<ProgressBar> bar;
+    if (show_bar) {
+        show_console_cursor(false);
+        bar.emplace(indicators::option::BarWidth{50},
+                    indicators::option::Start{"["},
+                    indicators::option::Fill{"■"},
+                    indicators::option::Lead{"■"},
+                    indicators::option::Remainder{"-"},
+                    indicators::option::End{" ]"},
+                    indicators::option::PrefixText{"DeepDendro Epoch: _ "},
+                    indicators::option::PostfixText{"Loss function: _"},
+                    indicators::option::ShowElapsedTime{true},
+                    indicators::option::ShowRemainingTime{true},
+                    indicators::option::ForegroundColor{Color::blue},
+                    indicators::option::FontStyles{std::vector<FontStyle>{FontStyle::bold}},
+                    indicators::option::MaxProgress{epochs});
+    }
+
+    // the bar shows the running figures of the current epoch, but is redrawn at most once per refresh_interval
+    auto redraw = [&]() {
+        if (!bar || epoch_samples == 0) {
+            return;
+        }
+        std::string postfix = "Loss function: " + std::to_string(epoch_loss / epoch_samples) +
+                              ", Accuracy: " + std::to_string(epoch_correct / epoch_samples * 100) + "%";
+        if (last_eval_accuracy >= 0) {
+            postfix += ", Validation: " + std::to_string(last_eval_accuracy * 100) + "%";
+        }
+        bar->set_option(indicators::option::PrefixText{
+                "DeepDendro epoch: " + std::to_string(current_epoch + 1) + out_of_all});
+        bar->set_option(indicators::option::PostfixText{postfix});
+        bar->set_progress(current_epoch);
+    };
+
+    const auto idle = std::min<std::chrono::milliseconds>(options.refresh_interval / 4,
+                                                          std::chrono::milliseconds{10});
+    auto last_redraw = std::chrono::steady_clock::now();
+    MetricsEvent event{};
+    while (true) {
+        // read the flag before draining, so nothing pushed before close() is missed
+        const bool last_round = closing.load(std::memory_order_acquire);
+        bool drained = false;
+        while (channel.try_pop(event)) {
+            handle(event);
+            drained = true;
+        }
+        if (last_round) {
+            break;
+        }
+        const auto now = std::chrono::steady_clock::now();
+        if (drained && now - last_redraw >= options.refresh_interval) {
+            redraw();
+            last_redraw = now;
+        } else if (!drained) {
+            std::this_thread::sleep_for(idle);
+        }
+    }
+
+    redraw();
+    if (bar) {
+        bar->set_progress(epochs);
+        show_console_cursor(true);
+    }
+    if (log != nullptr) {
+        log->flush();
+    }
+}
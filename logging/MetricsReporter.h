@@ -0,0 +1,117 @@
+#ifndef DEEPDENDRO_METRICSREPORTER_H
+#define DEEPDENDRO_METRICSREPORTER_H
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include "SPSCChannel.h"
+
+enum class LogFormat {
+    csv,
+    jsonl
+};
+
+struct ReportOptions {
+    // minimum time between two redraws of the progress bar
+    std::chrono::milliseconds refresh_interval{200};
+    // metrics log; when empty and stdout is not a terminal, the log is written to stdout instead of a bar
+    std::string log_path;
+    LogFormat format = LogFormat::csv;
+    // also log every n-th training step (0: only epoch summaries and evaluations)
+    size_t log_every_steps = 0;
+    // evaluate the validation set every n epochs (0: never)
+    size_t eval_every_epochs = 1;
+    // number of events the trainer may be ahead of the reporter; past that, step events are dropped (and
+    // counted), epoch and evaluation events wait for room
+    size_t channel_capacity = 4096;
+};
+
+struct MetricsEvent {
+    enum Kind {
+        // one training step; `loss` is its mean loss
+        training,
+        // the totals of a whole epoch, which the epoch summary is written from; `loss` is the mean loss
+        epoch_end,
+        evaluation
+    };
+
+    Kind kind;
+    size_t epoch;
+    // the step of the epoch; asynchronous data-parallel training sends one event per worker at the end of
+    // the epoch, summing the steps the worker trained, with the epoch's last step
+    size_t step;
+    // unused for evaluations
+    double loss;
+    double correct;
+    double samples;
+    // the data-parallel worker of an asynchronous training event, 0 otherwise
+    size_t worker = 0;
+};
+
+// Consumes training metrics on its own thread. The trainer only pushes a few scalars per step into a
+// lock-free channel; the progress bar (rate-limited), the running figures of the epoch and the buffered
+// CSV / JSONL log are all handled by the reporter thread, so reporting never stalls training. A step
+// event is dropped rather than wait when the reporter is a full channel behind: only the bar and the step
+// lines of the log miss it, the epoch summaries come from the trainer's own totals.
+class MetricsReporter {
+    SPSCChannel<MetricsEvent> channel;
+    ReportOptions options;
+    size_t epochs;
+
+    std::atomic<bool> closing{false};
+    std::atomic<size_t> dropped{0};
+    std::thread worker;
+
+    std::ofstream log_file;
+    std::ostream *log = nullptr;
+    bool show_bar;
+
+    // running figures of the epoch in progress, for the bar
+    size_t current_epoch = 0;
+    double epoch_loss = 0;
+    double epoch_correct = 0;
+    double epoch_samples = 0;
+    double last_eval_accuracy = -1;
+
+    void run();
+
+    void handle(const MetricsEvent &event);
+
+    void write(const char *kind, size_t epoch, size_t step, size_t worker, double loss, double accuracy,
+               double samples);
+
+public:
+    MetricsReporter(size_t epochs, const ReportOptions &options);
+
+    ~MetricsReporter();
+
+    MetricsReporter(const MetricsReporter &) = delete;
+    MetricsReporter &operator=(const MetricsReporter &) = delete;
+
+    // A step event never blocks: if the reporter has fallen behind by a full channel it is dropped.
+    // Epoch and evaluation events are never dropped, they wait for the reporter to make room.
+    void push(const MetricsEvent &event) noexcept {
+        if (event.kind == MetricsEvent::training) {
+            if (!channel.try_push(event)) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+            return;
+        }
+        while (!channel.try_push(event)) {
+            std::this_thread::yield();
+        }
+    }
+
+    // step events dropped so far
+    size_t dropped_steps() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+    // drains the remaining events, writes the last summaries and joins the reporter thread
+    void close();
+};
+
+
+#endif //DEEPDENDRO_METRICSREPORTER_H
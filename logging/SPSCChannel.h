@@ -0,0 +1,53 @@
+#ifndef DEEPDENDRO_SPSCCHANNEL_H
+#define DEEPDENDRO_SPSCCHANNEL_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Bounded lock-free single-producer / single-consumer ring buffer.
+// Neither side ever blocks: try_push fails when the buffer is full, try_pop when it is empty.
+template<typename T>
+class SPSCChannel {
+    std::vector<T> buffer;
+    size_t mask;
+
+    // written by the consumer only
+    alignas(64) std::atomic<size_t> head{0};
+    // written by the producer only
+    alignas(64) std::atomic<size_t> tail{0};
+
+public:
+    // the capacity is rounded up to a power of two
+    explicit SPSCChannel(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        buffer.resize(size);
+        mask = size - 1;
+    }
+
+    SPSCChannel(const SPSCChannel &) = delete;
+    SPSCChannel &operator=(const SPSCChannel &) = delete;
+
+    bool try_push(const T &el) noexcept {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == buffer.size()) {
+            return false;
+        }
+        buffer[t & mask] = el;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T &el) noexcept {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        el = buffer[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+#endif //DEEPDENDRO_SPSCCHANNEL_H
@@ -5,20 +5,60 @@
 #include "lossFunc.h"
 #include <iostream>
 
-double lossFunc::crossEntropy(const MatrixXd& predict, const MatrixXd& Y) {
+template<typename Scalar>
+Scalar lossFunc::crossEntropy(const MatrixT<Scalar>& predict, const MatrixT<Scalar>& Y) {
+    using Matrix = MatrixT<Scalar>;
 
     int m = Y.cols();
-    MatrixXd cost_mat = (-1 * Y.array() * log(predict.array())).matrix() -
+    Matrix cost_mat = (-1 * Y.array() * log(predict.array())).matrix() -
             ((1 - Y.array()).matrix().cwiseProduct(log1p(-predict.array()).matrix()));
-    double cost = cost_mat.sum() / m;
+    Scalar cost = cost_mat.sum() / m;
 
     return cost;
 }
 
-double lossFunc::categoryCrossEntropy(const MatrixXd& predict, const MatrixXd& Y) {
+template<typename Scalar>
+Scalar lossFunc::categoryCrossEntropy(const MatrixT<Scalar>& predict, const MatrixT<Scalar>& Y) {
+    using Matrix = MatrixT<Scalar>;
+
     int m = Y.cols();
-    MatrixXd log_pred = predict.array().log();
-    MatrixXd cost_mat = (-1.0 / m) * Y.cwiseProduct(log_pred);
-    double cost = cost_mat.sum();
+    Matrix log_pred = predict.array().log();
+    Matrix cost_mat = (Scalar(-1) / m) * Y.cwiseProduct(log_pred);
+    Scalar cost = cost_mat.sum();
     return cost;
-}
\ No newline at end of file
+}
+
+template<typename Scalar>
+Scalar lossFunc::softmaxCrossEntropy(const Eigen::Ref<const MatrixT<Scalar>>& logits,
+                                     const Eigen::Ref<const MatrixT<Scalar>>& Y,
+                                     Eigen::Ref<MatrixT<Scalar>> probabilities, Eigen::Ref<MatrixT<Scalar>> delta) {
+    Scalar cost = 0;
+    for (Eigen::Index j = 0; j < logits.cols(); ++j) {
+        const auto z = logits.col(j);
+        const auto y = Y.col(j);
+        auto p = probabilities.col(j);
+
+        // everything read from z comes before p is written, p may be z itself
+        const Scalar max = z.maxCoeff();
+        const Scalar y_dot_z = y.dot(z);
+        p = (z.array() - max).exp();
+        const Scalar sum = p.sum();
+        p /= sum;
+
+        // -sum(y * log(p)) with log(p) = z - max - log(sum), no log of a (possibly zero) probability
+        cost += (max + std::log(sum)) * y.sum() - y_dot_z;
+        delta.col(j) = p - y;
+    }
+    return cost / static_cast<Scalar>(logits.cols());
+}
+
+template float lossFunc::crossEntropy<float>(const MatrixT<float>&, const MatrixT<float>&);
+template double lossFunc::crossEntropy<double>(const MatrixT<double>&, const MatrixT<double>&);
+template float lossFunc::categoryCrossEntropy<float>(const MatrixT<float>&, const MatrixT<float>&);
+template double lossFunc::categoryCrossEntropy<double>(const MatrixT<double>&, const MatrixT<double>&);
+template float lossFunc::softmaxCrossEntropy<float>(const Eigen::Ref<const MatrixT<float>>&,
+                                                 const Eigen::Ref<const MatrixT<float>>&,
+                                                 Eigen::Ref<MatrixT<float>>, Eigen::Ref<MatrixT<float>>);
+template double lossFunc::softmaxCrossEntropy<double>(const Eigen::Ref<const MatrixT<double>>&,
+                                                 const Eigen::Ref<const MatrixT<double>>&,
+                                                 Eigen::Ref<MatrixT<double>>, Eigen::Ref<MatrixT<double>>);
@@ -7,8 +7,19 @@
 #include "Layer.h"
 class lossFunc {
 public:
-    double crossEntropy(const MatrixXd& predict, const MatrixXd& Y);
-    double categoryCrossEntropy(const MatrixXd& predict, const MatrixXd& Y);
+    template<typename Scalar>
+    Scalar crossEntropy(const MatrixT<Scalar>& predict, const MatrixT<Scalar>& Y);
+    template<typename Scalar>
+    Scalar categoryCrossEntropy(const MatrixT<Scalar>& predict, const MatrixT<Scalar>& Y);
+
+    // fused softmax + categorical cross-entropy over the logits, column by column:
+    // writes the (max-shifted, overflow-free) softmax into probabilities and its gradient
+    // (probabilities - Y) into delta, and returns the mean loss.
+    // Both outputs must already have the shape of the logits; probabilities may be the logits' own memory.
+    template<typename Scalar>
+    static Scalar softmaxCrossEntropy(const Eigen::Ref<const MatrixT<Scalar>>& logits,
+                                      const Eigen::Ref<const MatrixT<Scalar>>& Y,
+                                      Eigen::Ref<MatrixT<Scalar>> probabilities, Eigen::Ref<MatrixT<Scalar>> delta);
 };
 
 
@@ -32,8 +32,11 @@ int main() {
     model.addDense(32, activation::relu);
 
     bool verbose = true;
-    model.train(200, 0.005, verbose);
-    model.calc_accuracy(model.predict(data.testData), data.testLabels, verbose);
+    size_t batch_size = 64;
+    model.train(10, 0.05, verbose, batch_size);
+    ClassificationMetrics metrics = model.evaluate(data.testData, data.testLabels, 3, 4);
+    std::cout << "Test accuracy: " << 100 * metrics.accuracy() << "%, top-3: "
+              << 100 * metrics.top_k_accuracy() << "%" << std::endl;
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,22 @@
+#ifndef DEEPDENDRO_INFERENCECONTEXT_H
+#define DEEPDENDRO_INFERENCECONTEXT_H
+
+#include <vector>
+#include "Layer.h"
+#include "GemmWorkspace.h"
+
+// Scratch memory of one inference caller. Model's const predict methods only read the weights
+// and write here, so any number of threads can run inference on a shared model at once,
+// each with its own context. Created (and sized once) by Model::make_inference_context.
+template<typename Scalar = double>
+struct InferenceContext {
+    // activations ping-pong between the two buffers from layer to layer
+    MatrixT<Scalar> ping;
+    MatrixT<Scalar> pong;
+    // one set of GEMM packing buffers per dense layer
+    std::vector<GemmWorkspace<Scalar>> gemms;
+    // number of samples pushed through the network at once
+    Eigen::Index chunk = 0;
+};
+
+#endif //DEEPDENDRO_INFERENCECONTEXT_H
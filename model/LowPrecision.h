@@ -0,0 +1,114 @@
+#ifndef DEEPDENDRO_LOWPRECISION_H
+#define DEEPDENDRO_LOWPRECISION_H
+
+#include <cmath>
+#include <cstdint>
+#include <Eigen/Core>
+
+// How Model::train stores what it keeps between the steps of a training step, and the training set.
+// native keeps the model's scalar type. bf16 (8 bits of exponent, 7 of mantissa) and fp16 (5 and 10)
+// take 16 bits per value; the kernels still run and accumulate in the model's scalar type, so with
+// Model<float> the weights stay fp32 masters.
+enum class storage_format {
+    native,
+    bf16,
+    fp16
+};
+
+// Mixed-precision training for Model::train: the activations kept for the backward pass are converted
+// to 16 bits right after the forward pass that produced them and back just before the backward sweep
+// reads them; the training set is stored in 16 bits and converted batch by batch.
+struct MixedPrecisionConfig {
+    storage_format format = storage_format::native;
+    // round the activations up or down at random, with probabilities proportional to the distance to
+    // either neighbour, so the rounding error is zero on average; to nearest (even) otherwise.
+    // The training set is always rounded to nearest.
+    bool stochastic_rounding = false;
+    std::uint64_t seed = 0x2545F4914F6CDD1DULL;
+};
+
+// Conversions between a scalar buffer and 16-bit values, done with Eigen's software bfloat16 / half.
+namespace low_precision {
+    template<typename T>
+    using ArrayMap = Eigen::Map<Eigen::Array<T, Eigen::Dynamic, 1>>;
+
+    template<typename T>
+    using ConstArrayMap = Eigen::Map<const Eigen::Array<T, Eigen::Dynamic, 1>>;
+
+    // memory for `elements` 16-bit values, in Scalars (to be carved out of a Scalar arena)
+    template<typename Scalar>
+    Eigen::Index scalars_for(const Eigen::Index elements) {
+        constexpr auto per_scalar = static_cast<Eigen::Index>(sizeof(Scalar) / sizeof(std::uint16_t));
+        return (elements + per_scalar - 1) / per_scalar;
+    }
+
+    template<typename F>
+    void with_half_type(const storage_format format, F &&f) {
+        if (format == storage_format::bf16) {
+            f(Eigen::bfloat16{});
+        } else {
+            f(Eigen::half{});
+        }
+    }
+
+    // one step of xorshift64*
+    inline std::uint64_t next_random(std::uint64_t &state) {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1DULL;
+    }
+
+    // x rounded to one of the two 16-bit values around it, the closer one the more likely.
+    // The formats are sign-magnitude, so the bit pattern next to h in magnitude is h + 1 or h - 1.
+    template<typename Half>
+    std::uint16_t round_stochastic(const float x, const std::uint32_t random) {
+        const Half nearest(x);
+        std::uint16_t bits = Eigen::numext::bit_cast<std::uint16_t>(nearest);
+        const float y = static_cast<float>(nearest);
+        if (y == x || !std::isfinite(x)) {
+            return bits;
+        }
+        const std::uint16_t other = std::abs(y) > std::abs(x) ? bits - 1 : bits + 1;
+        const float z = static_cast<float>(Eigen::numext::bit_cast<Half>(other));
+        // probability of the farther neighbour: |x - y| / |z - y|, z is infinite past the largest value
+        const float p = std::abs(x - y) / std::abs(z - y);
+        return static_cast<float>(random >> 8) * (1.0f / 16777216.0f) < p ? other : bits;
+    }
+
+    // dst[i] = src[i] in 16 bits, rounded to nearest even
+    template<typename Scalar>
+    void pack(const storage_format format, const Scalar *src, std::uint16_t *dst, const Eigen::Index count) {
+        with_half_type(format, [&](auto half) {
+            using Half = decltype(half);
+            ArrayMap<Half>(reinterpret_cast<Half *>(dst), count) =
+                    ConstArrayMap<Scalar>(src, count).template cast<Half>();
+        });
+    }
+
+    // the same with stochastic rounding; state is the random generator's, advanced by every element
+    template<typename Scalar>
+    void pack_stochastic(const storage_format format, const Scalar *src, std::uint16_t *dst,
+                         const Eigen::Index count, std::uint64_t &state) {
+        with_half_type(format, [&](auto half) {
+            using Half = decltype(half);
+            for (Eigen::Index i = 0; i < count; ++i) {
+                const auto random = static_cast<std::uint32_t>(next_random(state) >> 32);
+                dst[i] = round_stochastic<Half>(static_cast<float>(src[i]), random);
+            }
+        });
+    }
+
+    // dst[i] = src[i] back in the scalar type, exact
+    template<typename Scalar>
+    void unpack(const storage_format format, const std::uint16_t *src, Scalar *dst, const Eigen::Index count) {
+        with_half_type(format, [&](auto half) {
+            using Half = decltype(half);
+            ArrayMap<Scalar>(dst, count) =
+                    ConstArrayMap<Half>(reinterpret_cast<const Half *>(src), count).template cast<Scalar>();
+        });
+    }
+}
+
+
+#endif //DEEPDENDRO_LOWPRECISION_H
@@ -0,0 +1,71 @@
+#include "MemoryPlanner.h"
+#include <algorithm>
+#include <iomanip>
+#include <numeric>
+
+MemoryPlan plan_memory(const std::vector<BufferRequest> &buffers, const size_t element_size,
+                       const Eigen::Index alignment) {
+    MemoryPlan plan;
+    plan.buffers = buffers;
+    plan.offsets.assign(buffers.size(), 0);
+    plan.element_size = element_size;
+
+    auto aligned = [alignment](Eigen::Index size) {
+        return (size + alignment - 1) / alignment * alignment;
+    };
+
+    std::vector<size_t> order(buffers.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return buffers[a].size > buffers[b].size;
+    });
+
+    std::vector<size_t> placed;
+    std::vector<std::pair<Eigen::Index, Eigen::Index>> taken;
+    for (const size_t i: order) {
+        const BufferRequest &buffer = buffers[i];
+        plan.naive_size += aligned(buffer.size);
+        if (buffer.size == 0) {
+            continue;
+        }
+
+        // address ranges of the placed buffers alive at the same time, by start
+        taken.clear();
+        for (const size_t j: placed) {
+            if (buffers[j].first_use <= buffer.last_use && buffer.first_use <= buffers[j].last_use) {
+                taken.emplace_back(plan.offsets[j], plan.offsets[j] + aligned(buffers[j].size));
+            }
+        }
+        std::sort(taken.begin(), taken.end());
+
+        // lowest gap that fits
+        Eigen::Index offset = 0;
+        for (const auto &[start, end]: taken) {
+            if (start - offset >= buffer.size) {
+                break;
+            }
+            offset = std::max(offset, end);
+        }
+
+        plan.offsets[i] = offset;
+        plan.planned_size = std::max(plan.planned_size, offset + aligned(buffer.size));
+        placed.push_back(i);
+    }
+    return plan;
+}
+
+std::ostream &operator<<(std::ostream &os, const MemoryPlan &plan) {
+    constexpr double MiB = 1024. * 1024.;
+    os << std::fixed << std::setprecision(2);
+    for (size_t i = 0; i < plan.buffers.size(); i++) {
+        const BufferRequest &buffer = plan.buffers[i];
+        os << std::setw(24) << std::left << buffer.name << std::right
+           << " steps " << std::setw(3) << buffer.first_use << " - " << std::setw(3) << buffer.last_use
+           << "  offset " << std::setw(9) << static_cast<double>(plan.offsets[i] * plan.element_size) / MiB << " MiB"
+           << "  size " << std::setw(9) << static_cast<double>(buffer.size * plan.element_size) / MiB << " MiB\n";
+    }
+    os << "planned peak: " << static_cast<double>(plan.planned_bytes()) / MiB << " MiB, naive: "
+       << static_cast<double>(plan.naive_bytes()) / MiB << " MiB\n";
+    os << std::defaultfloat;
+    return os;
+}
@@ -0,0 +1,57 @@
+#ifndef DEEPDENDRO_MEMORYPLANNER_H
+#define DEEPDENDRO_MEMORYPLANNER_H
+
+#include <Eigen/Core>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// One buffer of a training step: live from the first to the last step (inclusive) that touches it.
+// Steps are positions in the step's schedule, sizes are in elements.
+struct BufferRequest {
+    std::string name;
+    Eigen::Index size;
+    size_t first_use;
+    size_t last_use;
+};
+
+// Placement of the buffers in one arena: buffers whose lifetimes do not overlap may share memory.
+struct MemoryPlan {
+    std::vector<BufferRequest> buffers;
+    // element offset of every buffer in the arena, in the order of `buffers`
+    std::vector<Eigen::Index> offsets;
+    // arena size, and the total if every buffer had memory of its own
+    Eigen::Index planned_size = 0;
+    Eigen::Index naive_size = 0;
+    size_t element_size = sizeof(double);
+
+    size_t planned_bytes() const {
+        return planned_size * element_size;
+    }
+
+    size_t naive_bytes() const {
+        return naive_size * element_size;
+    }
+};
+
+// Gradient checkpointing for Model::train. The layers whose outputs are kept from the forward sweep
+// until the backward one are the checkpoints; every other layer is run forward a second time during
+// the backward sweep, from the closest checkpoint below it. Layers are numbered in the order they were
+// added (convolutional and pooling stages, then dense layers); the output layer is always kept.
+struct CheckpointConfig {
+    bool enabled = false;
+    // the checkpoints are picked so that the training arena fits this many bytes; with 0 as many
+    // layers are recomputed as makes the arena smaller
+    size_t memory_budget = 0;
+    // explicit checkpoints, override the budget when given
+    std::vector<size_t> checkpoints;
+};
+
+// Liveness-based placement: buffers are placed largest first, each at the lowest offset where it does
+// not overlap a placed buffer that is alive at the same time. Offsets are aligned to `alignment` elements.
+MemoryPlan plan_memory(const std::vector<BufferRequest> &buffers, size_t element_size, Eigen::Index alignment = 16);
+
+std::ostream &operator<<(std::ostream &os, const MemoryPlan &plan);
+
+
+#endif //DEEPDENDRO_MEMORYPLANNER_H
@@ -3,120 +3,1270 @@
 //
 
 #include "Model.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <utility>
+#include <thread>
+#include <stdexcept>
 
 
-Model::Model() {
+template<typename Scalar>
+Model<Scalar>::Model() {
     dense_layers.reserve(10);
 }
 
-void Model::addInput(const MatrixXd &data) {
-    train_data = data;
+template<typename Scalar>
+void Model<Scalar>::addInput(const Matrix &data) {
+    addInput(std::make_shared<const Matrix>(data));
 }
 
-void Model::addOutput(const MatrixXd &labels) {
-    train_labels = labels;
+template<typename Scalar>
+void Model<Scalar>::addInput(const Matrix &data, const TensorShape sample_shape) {
+    addInput(std::make_shared<const Matrix>(data), sample_shape);
 }
 
-void Model::addDense(int neurons, activation activationType) {
+template<typename Scalar>
+void Model<Scalar>::addInput(std::shared_ptr<const Matrix> data) {
+    if (!data) {
+        throw std::invalid_argument("Model::addInput: no data");
+    }
+    train_data = std::move(data);
+    packed_train_data.reset();
+    train_data_format = storage_format::native;
+    store_train_data();
+}
+
+template<typename Scalar>
+void Model<Scalar>::addInput(std::shared_ptr<const Matrix> data, const TensorShape sample_shape) {
+    if (!data) {
+        throw std::invalid_argument("Model::addInput: no data");
+    }
+    if (sample_shape[0] * sample_shape[1] * sample_shape[2] != data->rows()) {
+        throw std::invalid_argument("Model::addInput: sample shape does not match the number of rows");
+    }
+    train_data = std::move(data);
+    packed_train_data.reset();
+    train_data_format = storage_format::native;
+    store_train_data();
+    current_shape = sample_shape;
+    has_tensor_input = true;
+}
+
+template<typename Scalar>
+void Model<Scalar>::addConv(const size_t n_filters, const std::array<Eigen::Index, 2> kernel,
+                            const activation activationType) {
+    if (!has_tensor_input || flattened) {
+        throw std::logic_error("Model::addConv: needs an input with a sample shape, before addFlatten");
+    }
+    conv_layers.emplace_back(n_filters, TensorShape{kernel[0], kernel[1], current_shape[2]}, activationType,
+                             current_shape);
+    conv_layers.back().set_precision(activation_precision);
+    stages.emplace_back(CONVOLUTION, conv_layers.size() - 1);
+    current_shape = conv_layers.back().getOutputShape();
+}
+
+template<typename Scalar>
+void Model<Scalar>::addMaxPool(const std::array<Eigen::Index, 2> grid, const std::array<Eigen::Index, 2> stride) {
+    if (!has_tensor_input || flattened) {
+        throw std::logic_error("Model::addMaxPool: needs an input with a sample shape, before addFlatten");
+    }
+    pool_layers.emplace_back(current_shape, TensorShape{grid[0], grid[1], 1}, TensorShape{stride[0], stride[1], 1});
+    stages.emplace_back(POOLING, pool_layers.size() - 1);
+    current_shape = pool_layers.back().output_shape;
+}
+
+template<typename Scalar>
+void Model<Scalar>::addFlatten() {
+    if (!has_tensor_input || flattened) {
+        throw std::logic_error("Model::addFlatten: needs an input with a sample shape, only once");
+    }
+    flattened = true;
+}
+
+template<typename Scalar>
+void Model<Scalar>::addOutput(const Matrix &labels) {
+    addOutput(std::make_shared<const Matrix>(labels));
+}
+
+template<typename Scalar>
+void Model<Scalar>::addOutput(std::shared_ptr<const Matrix> labels) {
+    if (!labels) {
+        throw std::invalid_argument("Model::addOutput: no labels");
+    }
+    train_labels = std::move(labels);
+}
+
+template<typename Scalar>
+void Model<Scalar>::setOptimizer(const OptimizerConfig &config) {
+    optimizer_config = config;
+    optimizers_set = false;
+}
+
+template<typename Scalar>
+void Model<Scalar>::setPrecision(const precision accuracy) {
+    activation_precision = accuracy;
+    for (auto &layer: dense_layers) {
+        layer.set_precision(accuracy);
+    }
+    for (auto &conv: conv_layers) {
+        conv.set_precision(accuracy);
+    }
+}
+
+template<typename Scalar>
+void Model<Scalar>::addValidation(const Matrix &data, const Matrix &labels) {
+    addValidation(std::make_shared<const Matrix>(data), std::make_shared<const Matrix>(labels));
+}
+
+template<typename Scalar>
+void Model<Scalar>::addValidation(std::shared_ptr<const Matrix> data, std::shared_ptr<const Matrix> labels) {
+    if (!data || !labels) {
+        throw std::invalid_argument("Model::addValidation: no data or labels");
+    }
+    validation_data = std::move(data);
+    validation_labels = std::move(labels);
+}
+
+template<typename Scalar>
+void Model<Scalar>::setReportOptions(const ReportOptions &options) {
+    report_options = options;
+}
+
+template<typename Scalar>
+void Model<Scalar>::addDense(int neurons, activation activationType) {
+    if (has_tensor_input && !flattened) {
+        throw std::logic_error("Model::addDense: the convolutional stages must be closed by addFlatten");
+    }
     MShape prev_shape;
     if (dense_layers.empty()) {
-        prev_shape = {train_data.rows(), train_data.cols()};
+        const Eigen::Index features = current_shape[0] * current_shape[1] * current_shape[2];
+        prev_shape = {has_tensor_input ? features : train_features(), train_samples()};
     } else {
         prev_shape = dense_layers.back().shape;
     }
 
     dense_layers.emplace_back(neurons, prev_shape, activationType);
+    dense_layers.back().set_precision(activation_precision);
+}
+
+
+template<typename Scalar>
+void Model<Scalar>::create_mini_batches() {
+    std::shuffle(permutation.begin(), permutation.end(), rng);
+}
+
+template<typename Scalar>
+Eigen::Index Model<Scalar>::load_mini_batch(const Eigen::Index start) {
+    return gather_columns(start, batch_data, batch_labels);
+}
+
+template<typename Scalar>
+Eigen::Index Model<Scalar>::gather_columns(const Eigen::Index start, Matrix &data, Matrix &labels) const {
+    // the last batch of an epoch stops at the end of the permutation: every sample is trained once per
+    // epoch, the buffers are not resized for the shorter batch
+    const Eigen::Index count = std::clamp(static_cast<Eigen::Index>(permutation.size()) - start, Eigen::Index(0),
+                                          data.cols());
+    for (Eigen::Index i = 0; i < count; ++i) {
+        const Eigen::Index sample = permutation[start + i];
+        if (train_data_format == storage_format::native) {
+            data.col(i) = train_data->col(sample);
+        } else {
+            low_precision::unpack(train_data_format, packed_train_data->col(sample).data(), data.col(i).data(),
+                                  data.rows());
+        }
+        labels.col(i) = train_labels->col(sample);
+    }
+    return count;
+}
+
+template<typename Scalar>
+void Model<Scalar>::set_step_width(const Eigen::Index width) {
+    if (width == step_width) {
+        return;
+    }
+    step_width = width;
+    for (size_t u = 0; u < stages.size() + dense_layers.size(); u++) {
+        bind_unit(u, kept[u] ? forward_workspace[u] : backward_workspace[u]);
+    }
+}
+
+template<typename Scalar>
+const MatrixMapT<Scalar> &Model<Scalar>::stage_a_values(const size_t k) const {
+    const auto [type, index] = stages[k];
+    return type == CONVOLUTION ? conv_layers[index].getAValues() : pool_layers[index].getAValues();
+}
+
+template<typename Scalar>
+const MatrixMapT<Scalar> &Model<Scalar>::unit_a_values(const size_t u) const {
+    return u < stages.size() ? stage_a_values(u) : dense_layers[u - stages.size()].getAValues();
+}
+
+template<typename Scalar>
+void Model<Scalar>::store_train_data() {
+    if (mixed_precision.format == train_data_format) {
+        return;
+    }
+    if (train_data_format != storage_format::native) {
+        auto unpacked = std::make_shared<Matrix>(packed_train_data->rows(), packed_train_data->cols());
+        low_precision::unpack(train_data_format, packed_train_data->data(), unpacked->data(), unpacked->size());
+        train_data = std::move(unpacked);
+        packed_train_data.reset();
+    }
+    train_data_format = mixed_precision.format;
+    if (train_data_format != storage_format::native) {
+        auto packed = std::make_shared<Eigen::Matrix<std::uint16_t, Eigen::Dynamic, Eigen::Dynamic>>(
+                train_data->rows(), train_data->cols());
+        low_precision::pack(train_data_format, train_data->data(), packed->data(), train_data->size());
+        packed_train_data = std::move(packed);
+        // freed unless another model shares it
+        train_data = std::make_shared<const Matrix>();
+    }
+}
+
+template<typename Scalar>
+Eigen::Index Model<Scalar>::train_samples() const {
+    return train_data_format == storage_format::native ? train_data->cols() : packed_train_data->cols();
+}
+
+template<typename Scalar>
+Eigen::Index Model<Scalar>::train_features() const {
+    return train_data_format == storage_format::native ? train_data->rows() : packed_train_data->rows();
+}
+
+template<typename Scalar>
+void Model<Scalar>::pack_unit(const size_t u) {
+    const MatrixMapT<Scalar> &a = unit_a_values(u);
+    auto *half = reinterpret_cast<std::uint16_t *>(forward_workspace[u].packed);
+    if (mixed_precision.stochastic_rounding) {
+        low_precision::pack_stochastic(mixed_precision.format, a.data(), half, a.size(), rounding_state);
+    } else {
+        low_precision::pack(mixed_precision.format, a.data(), half, a.size());
+    }
+}
+
+template<typename Scalar>
+void Model<Scalar>::restore_unit(const size_t u) {
+    bind_unit(u, backward_workspace[u]);
+    low_precision::unpack(mixed_precision.format, reinterpret_cast<const std::uint16_t *>(forward_workspace[u].packed),
+                          backward_workspace[u].a, unit_a_values(u).size());
+}
+
+template<typename Scalar>
+Eigen::Ref<const MatrixT<Scalar>> Model<Scalar>::stage_input(const size_t k, const Eigen::Ref<const Matrix> &data) const {
+    if (k == 0) {
+        return data;
+    }
+    return stage_a_values(k - 1);
+}
+
+template<typename Scalar>
+Eigen::Ref<const MatrixT<Scalar>> Model<Scalar>::dense_input(const Eigen::Ref<const Matrix> &data) const {
+    return stage_input(stages.size(), data);
+}
+
+template<typename Scalar>
+void Model<Scalar>::forward_prop(const Matrix &data, const bool training) {
+    for (size_t u = 0; u < stages.size() + dense_layers.size(); u++) {
+        forward_unit(u, data, training);
+    }
+}
+
+template<typename Scalar>
+void Model<Scalar>::forward_unit(const size_t u, const Eigen::Ref<const Matrix> &data, const bool training) {
+    if (u < stages.size()) {
+        const auto [type, index] = stages[u];
+        if (type == CONVOLUTION) {
+            conv_layers[index].forward_prop(stage_input(u, data));
+        } else {
+            pool_layers[index].forward_prop(stage_input(u, data));
+        }
+        return;
+    }
+
+    const size_t k = u - stages.size();
+    const Eigen::Ref<const Matrix> prev = k == 0 ? dense_input(data) : dense_layers[k - 1].getAValues();
+    // during training the output softmax is left to the fused loss head
+    if (training && k + 1 == dense_layers.size()) {
+        dense_layers[k].forward_prop_logits(prev);
+    } else {
+        dense_layers[k].forward_prop(prev);
+    }
+}
+
+template<typename Scalar>
+void Model<Scalar>::backward_unit(const size_t u, const Eigen::Ref<const Matrix> &data,
+                                  const Eigen::Ref<const Matrix> &labels, const double learning_rate,
+                                  const MatrixMapT<Scalar> *&gradient) {
+    // every unit hands out a reference to its own gradient buffer and is updated right after it,
+    // so its input is dead from then on: the memory plan relies on it
+    if (u < stages.size()) {
+        const auto [type, index] = stages[u];
+        if (type == CONVOLUTION) {
+            gradient = &conv_layers[index].calc_back_prop(*gradient, stage_input(u, data), u > 0);
+            if (!replica) {
+                conv_layers[index].apply_back_prop(learning_rate);
+            }
+        } else {
+            gradient = &pool_layers[index].calc_back_prop(*gradient);
+        }
+        return;
+    }
+
+    const size_t k = u - stages.size();
+    auto &layer = dense_layers[k];
+    if (k + 1 == dense_layers.size()) {
+        layer.calc_first_back_prop(labels);
+    } else {
+        layer.calc_delta(*gradient);
+    }
+    // the first layer does not need the gradient w.r.t. the input data
+    if (u > 0) {
+        gradient = &layer.calc_gradient();
+    }
+    const Eigen::Ref<const Matrix> prev = k == 0 ? dense_input(data) : dense_layers[k - 1].getAValues();
+    if (replica) {
+        layer.calc_param_gradient(prev);
+    } else {
+        layer.apply_back_prop(learning_rate, prev);
+    }
+}
+
+template<typename Scalar>
+void Model<Scalar>::bind_unit(const size_t u, const UnitWorkspace &workspace) {
+    if (u < stages.size()) {
+        const auto [type, index] = stages[u];
+        if (type == CONVOLUTION) {
+            conv_layers[index].bind_workspace(step_width, workspace.saved, workspace.a, workspace.delta,
+                                              workspace.gradient);
+        } else {
+            pool_layers[index].bind_workspace(step_width, workspace.a, workspace.gradient);
+        }
+    } else {
+        dense_layers[u - stages.size()].bind_workspace(step_width, workspace.saved, workspace.a, workspace.delta,
+                                                       workspace.gradient);
+    }
+}
+
+template<typename Scalar>
+void Model<Scalar>::train_step(const Eigen::Ref<const Matrix> &data, const Eigen::Ref<const Matrix> &labels,
+                               const double learning_rate) {
+    const size_t n = stages.size() + dense_layers.size();
+    for (size_t u = 0; u < n; u++) {
+        if (!kept[u] || packed[u]) {
+            bind_unit(u, forward_workspace[u]);
+        }
+    }
+    for (size_t u = 0; u < n; u++) {
+        forward_unit(u, data, true);
+        if (packed[u]) {
+            pack_unit(u);
+        }
+    }
+
+    // Backward sweep from the output layer down, one segment at a time: a segment ends with a kept unit
+    // and starts after the previous one. The units in between dropped their outputs in the forward sweep,
+    // they are run forward again from the previous kept output (still with their old weights) first.
+    // That output, if it was packed to 16 bits, is restored before.
+    const MatrixMapT<Scalar> *gradient = nullptr;
+    for (size_t end = n; end > 0;) {
+        size_t begin = end - 1;
+        while (begin > 0 && !kept[begin - 1]) {
+            begin--;
+        }
+        if (begin > 0 && packed[begin - 1]) {
+            restore_unit(begin - 1);
+        }
+        for (size_t u = begin; u + 1 < end; u++) {
+            bind_unit(u, backward_workspace[u]);
+            forward_unit(u, data, true);
+        }
+        for (size_t u = end; u-- > begin;) {
+            backward_unit(u, data, labels, learning_rate, gradient);
+        }
+        end = begin;
+    }
 }
 
+template<typename Scalar>
+MemoryPlan Model<Scalar>::plan_step(const Eigen::Index batch, const std::vector<bool> &keep, const bool half_storage,
+                                    std::vector<std::array<size_t, 7>> *slots) const {
+    // Schedule of one step over n units (stages, then dense layers): unit u runs forward at step u. The
+    // backward sweep then goes segment by segment (see train_step): with half storage the kept output
+    // below the segment is restored first, the recomputed units of the segment get a step each, then
+    // every unit of the segment one for its backward pass and update.
+    const size_t n = stages.size() + dense_layers.size();
+    constexpr size_t none = std::numeric_limits<size_t>::max();
+    auto is_pool = [this](size_t u) { return u < stages.size() && stages[u].first == POOLING; };
+    auto saves_mask = [this](size_t u) {
+        if (u < stages.size()) {
+            return stages[u].first == CONVOLUTION && conv_layers[stages[u].second].saves_mask();
+        }
+        return dense_layers[u - stages.size()].saves_mask();
+    };
+    // a kept output is packed when the backward sweep reads it: the next unit's backward (unless that
+    // is a pooling) or recomputation, or its own backward (unless it has a mask or is a pooling)
+    auto packs = [&](size_t u) {
+        return half_storage && keep[u] && u + 1 < n &&
+               (!is_pool(u + 1) || !keep[u + 1] || !(is_pool(u) || saves_mask(u)));
+    };
 
-void Model::train(size_t epochs, double learning_rate, const bool verbose) {
-    const std::string out_of_all = " / " + std::to_string(epochs) + " ";
-    double accuracy = 0;
-    show_console_cursor(false);
-    ProgressBar bar{
-            indicators::option::BarWidth{50},
-            indicators::option::Start{"["},
-            indicators::option::Fill{"■"},
-            indicators::option::Lead{"■"},
-            indicators::option::Remainder{"-"},
-            indicators::option::End{" ]"},
-            indicators::option::PrefixText{"DeepDendro Epoch: _ "},
-            indicators::option::PostfixText{"Loss function: _"},
-            indicators::option::ShowElapsedTime{true},
-            indicators::option::ShowRemainingTime{true},
-            indicators::option::ForegroundColor{Color::blue},
-            indicators::option::FontStyles{std::vector<FontStyle>{FontStyle::bold}},
-            indicators::option::MaxProgress{epochs}
+    std::vector<size_t> recompute(n, none), restore(n, none), backward(n);
+    size_t step = n;
+    for (size_t end = n; end > 0;) {
+        size_t begin = end - 1;
+        while (begin > 0 && !keep[begin - 1]) {
+            begin--;
+        }
+        if (begin > 0 && packs(begin - 1)) {
+            restore[begin - 1] = step++;
+        }
+        for (size_t u = begin; u + 1 < end; u++) {
+            recompute[u] = step++;
+        }
+        for (size_t u = end; u-- > begin;) {
+            backward[u] = step++;
+        }
+        end = begin;
+    }
+    // the loss head's probabilities are read after the step
+    const size_t after = step;
+
+    // an output is read by the forward (and recomputation) of the next unit, and by its backward
+    // unless that is a pooling
+    auto backward_reader = [&](size_t u) { return is_pool(u + 1) ? 0 : backward[u + 1]; };
+    auto recompute_reader = [&](size_t u) { return recompute[u + 1] == none ? 0 : recompute[u + 1]; };
+
+    std::vector<BufferRequest> requests;
+    auto request = [&](const std::string &name, Eigen::Index size, size_t first, size_t last) {
+        requests.push_back({name, size, first, std::max(first, last)});
+        return requests.size() - 1;
     };
 
+    for (size_t u = 0; u < n; u++) {
+        // what the unit saves for its backward pass besides its output (a ReLU mask, or nothing), its output
+        // and its input, per batch
+        Eigen::Index outputs, inputs, saved = 0;
+        bool mask = false;
+        std::string name;
+        if (u < stages.size()) {
+            const auto [type, index] = stages[u];
+            if (type == CONVOLUTION) {
+                const auto &conv = conv_layers[index];
+                outputs = conv.getOutputSize() * batch;
+                inputs = conv.getInputSize() * batch;
+                saved = conv.saved_size(batch);
+                mask = conv.saves_mask();
+            } else {
+                outputs = pool_layers[index].getOutputSize() * batch;
+                inputs = pool_layers[index].getInputSize() * batch;
+            }
+            name = (type == CONVOLUTION ? "conv" : "pool") + std::to_string(index);
+        } else {
+            const auto &layer = dense_layers[u - stages.size()];
+            outputs = static_cast<Eigen::Index>(layer.shape.first) * batch;
+            inputs = layer.getInputSize() * batch;
+            saved = layer.saved_size(batch);
+            mask = layer.saves_mask();
+            name = "dense" + std::to_string(u - stages.size());
+        }
+        const std::string saved_name = name + ".mask";
+        // without a mask the unit's own backward takes the activation derivative from its output
+        const size_t own_reader = mask || is_pool(u) ? 0 : backward[u];
 
-    MatrixXd gradient;
-    addDense(train_labels.rows(), activation::softmax);
-    for (size_t i = 0; i < epochs; ++i) {
-        // first forward prop
-        dense_layers[0].forward_prop(train_data);
-        for (int k = 1; k < dense_layers.size(); k++) {
-            dense_layers[k].forward_prop(dense_layers[k - 1].getAValues());
+        // saved, a, delta and input gradient, then saved and a of the recomputation (or restoration), packed a
+        std::array<size_t, 7> slot;
+        slot.fill(none);
+        if (u + 1 == n) {
+            // the output layer's logits become the loss head's probabilities, which are read after the step
+            slot[1] = request(name + ".a", outputs, u, after);
+        } else if (keep[u]) {
+            const size_t last_read = std::max({u + 1, recompute_reader(u), backward_reader(u), own_reader});
+            if (saved > 0) {
+                slot[0] = request(saved_name, saved, u, backward[u]);
+            }
+            if (packs(u)) {
+                // only the 16-bit copy lives from the next unit's forward until the restoration
+                slot[1] = request(name + ".a", outputs, u, u + 1);
+                slot[6] = request(name + ".a (16-bit)", low_precision::scalars_for<Scalar>(outputs), u, restore[u]);
+                slot[5] = request(name + ".a (restored)", outputs, restore[u], last_read);
+            } else {
+                slot[1] = request(name + ".a", outputs, u, last_read);
+            }
+        } else {
+            // dropped after the next unit's forward, then recomputed just before the segment's backward
+            if (saved > 0) {
+                slot[0] = request(saved_name, saved, u, u);
+                slot[4] = request(saved_name + " (recomputed)", saved, recompute[u], backward[u]);
+            }
+            slot[1] = request(name + ".a", outputs, u, u + 1);
+            slot[5] = request(name + ".a (recomputed)", outputs, recompute[u],
+                              std::max({recompute_reader(u), backward_reader(u), own_reader}));
+        }
+        if (!is_pool(u)) {
+            slot[2] = request(name + ".delta", outputs, backward[u], backward[u]);
+        }
+        if (u > 0) {
+            slot[3] = request(name + ".gradient", inputs, backward[u], backward[u - 1]);
+        }
+        if (keep[u]) {
+            slot[4] = slot[0];
+            if (slot[6] == none) {
+                slot[5] = slot[1];
+            }
+        }
+        if (slots) {
+            slots->push_back(slot);
+        }
+    }
+    return plan_memory(requests, sizeof(Scalar));
+}
+
+template<typename Scalar>
+std::vector<bool> Model<Scalar>::choose_checkpoints(const Eigen::Index batch) const {
+    const size_t n = stages.size() + dense_layers.size();
+    std::vector<bool> keep(n, true);
+    if (!checkpoint_config.enabled) {
+        return keep;
+    }
+    if (!checkpoint_config.checkpoints.empty()) {
+        std::fill(keep.begin(), keep.end(), false);
+        for (const size_t u: checkpoint_config.checkpoints) {
+            if (u >= n) {
+                throw std::invalid_argument("Model::setCheckpointing: no layer " + std::to_string(u));
+            }
+            keep[u] = true;
+        }
+        keep[n - 1] = true;
+        return keep;
+    }
+
+    // Greedy: drop the checkpoint whose recomputation shrinks the planned arena the most, until it fits
+    // the budget (or, without one, until dropping more does not help any more)
+    const auto budget = static_cast<Eigen::Index>(checkpoint_config.memory_budget);
+    const bool half_storage = mixed_precision.format != storage_format::native;
+    Eigen::Index size = plan_step(batch, keep, half_storage, nullptr).planned_bytes();
+    while (budget == 0 || size > budget) {
+        size_t best = n;
+        Eigen::Index best_size = size;
+        for (size_t u = 0; u + 1 < n; u++) {
+            if (!keep[u]) {
+                continue;
+            }
+            keep[u] = false;
+            const auto candidate = static_cast<Eigen::Index>(plan_step(batch, keep, half_storage, nullptr).planned_bytes());
+            if (candidate < best_size) {
+                best = u;
+                best_size = candidate;
+            }
+            keep[u] = true;
+        }
+        if (best == n) {
+            break;
+        }
+        keep[best] = false;
+        size = best_size;
+    }
+    if (budget != 0 && size > budget) {
+        std::cerr << "Model::train: checkpointing cannot fit the memory budget, the plan takes "
+                  << size << " bytes" << std::endl;
+    }
+    return keep;
+}
+
+template<typename Scalar>
+void Model<Scalar>::plan_training_memory(const Eigen::Index batch) {
+    const size_t n = stages.size() + dense_layers.size();
+    kept = choose_checkpoints(batch);
+
+    const bool half_storage = mixed_precision.format != storage_format::native;
+    std::vector<std::array<size_t, 7>> slots;
+    memory_plan = plan_step(batch, kept, half_storage, &slots);
+    // the naive peak is reported without the recomputation and 16-bit copies, as if nothing was
+    // checkpointed and everything was stored in the model's scalar type
+    memory_plan.naive_size = plan_step(batch, std::vector<bool>(n, true), false, nullptr).naive_size;
+
+    Scalar *base = arena.allocate(memory_plan.planned_size);
+    step_width = batch;
+    auto at = [&](size_t i) { return i < memory_plan.offsets.size() ? base + memory_plan.offsets[i] : nullptr; };
+    forward_workspace.resize(n);
+    backward_workspace.resize(n);
+    packed.assign(n, false);
+    for (size_t u = 0; u < n; u++) {
+        const auto &slot = slots[u];
+        forward_workspace[u] = {at(slot[0]), at(slot[1]), at(slot[2]), at(slot[3]), at(slot[6])};
+        backward_workspace[u] = {at(slot[4]), at(slot[5]), at(slot[2]), at(slot[3]), at(slot[6])};
+        packed[u] = forward_workspace[u].packed != nullptr;
+        bind_unit(u, kept[u] ? forward_workspace[u] : backward_workspace[u]);
+    }
+    rounding_state = mixed_precision.seed | 1;
+}
+
+template<typename Scalar>
+void Model<Scalar>::setCheckpointing(const CheckpointConfig &config) {
+    checkpoint_config = config;
+}
+
+template<typename Scalar>
+void Model<Scalar>::setMixedPrecision(const MixedPrecisionConfig &config) {
+    mixed_precision = config;
+    // packed now rather than in train(), so that copies of the model share the packed set
+    store_train_data();
+}
+
+template<typename Scalar>
+void Model<Scalar>::setPruning(const PruningConfig &config) {
+    pruning_config = config;
+}
+
+template<typename Scalar>
+void Model<Scalar>::setDataParallel(const DataParallelConfig &config) {
+    data_parallel = config;
+}
+
+template<typename Scalar>
+void Model<Scalar>::make_replicas(const Eigen::Index batch) {
+    // asynchronous: one replica per worker, training whole batches
+    const bool asynchronous = data_parallel.asynchronous;
+    const auto shards = static_cast<Eigen::Index>(data_parallel.shards != 0 && !asynchronous
+                                                  ? data_parallel.shards : data_parallel.worker_count());
+    replicas.clear();
+    replicas.resize(static_cast<size_t>(asynchronous ? shards : std::min(shards, batch)));
+    const auto n_replicas = static_cast<Eigen::Index>(replicas.size());
+    for (Eigen::Index r = 0; r < n_replicas; ++r) {
+        Model &copy = replicas[r];
+        copy.replica = true;
+        copy.stages = stages;
+        copy.conv_layers = conv_layers;
+        copy.pool_layers = pool_layers;
+        copy.dense_layers = dense_layers;
+        // synchronous replicas keep no optimizer state, the model updates the parameters
+        const OptimizerConfig replica_optimizer = asynchronous ? optimizer_config : OptimizerConfig{};
+        for (auto &layer: copy.dense_layers) {
+            layer.set_optimizer(replica_optimizer);
+        }
+        for (auto &conv: copy.conv_layers) {
+            conv.set_optimizer(replica_optimizer);
+        }
+        copy.checkpoint_config = checkpoint_config;
+        copy.checkpoint_config.memory_budget /= static_cast<size_t>(n_replicas);
+        // 16-bit activations only: the replicas gather their shards from this model's training set
+        copy.mixed_precision = mixed_precision;
+        copy.activation_precision = activation_precision;
+
+        const Eigen::Index shard = asynchronous ? batch : (r + 1) * batch / n_replicas - r * batch / n_replicas;
+        copy.batch_data.resize(train_features(), shard);
+        copy.batch_labels.resize(train_labels->rows(), shard);
+        copy.plan_training_memory(shard);
+    }
+    // the model's own arena is not used, the plan reported is that of the largest replica's
+    memory_plan = std::max_element(replicas.begin(), replicas.end(), [](const Model &a, const Model &b) {
+        return a.memory_plan.planned_bytes() < b.memory_plan.planned_bytes();
+    })->memory_plan;
+}
+
+template<typename Scalar>
+std::vector<ParameterBlock<Scalar>> Model<Scalar>::parameter_blocks() {
+    std::vector<ParameterBlock<Scalar>> blocks;
+    for (auto &conv: conv_layers) {
+        const auto layer_blocks = conv.parameter_blocks();
+        blocks.insert(blocks.end(), layer_blocks.begin(), layer_blocks.end());
+    }
+    for (auto &layer: dense_layers) {
+        const auto layer_blocks = layer.parameter_blocks();
+        blocks.insert(blocks.end(), layer_blocks.begin(), layer_blocks.end());
+    }
+    return blocks;
+}
+
+template<typename Scalar>
+void Model<Scalar>::data_parallel_step(WorkerTeam &team, const Eigen::Index start, const double learning_rate,
+                                       double *loss, double *correct, WorkerStats *stats) {
+    using Array = Eigen::Array<Scalar, Eigen::Dynamic, 1>;
+    const size_t workers = team.size();
+    // a short last batch is split between as many replicas as it has samples, at most
+    const Eigen::Index width = std::min(batch_data.cols(), static_cast<Eigen::Index>(permutation.size()) - start);
+    const size_t n_replicas = std::min(replicas.size(), static_cast<size_t>(width));
+    const auto batch = static_cast<double>(width);
+
+    for (auto &conv: conv_layers) {
+        conv.begin_update();
+    }
+    for (auto &layer: dense_layers) {
+        layer.begin_update();
+    }
+    const std::vector<ParameterBlock<Scalar>> blocks = parameter_blocks();
+    std::vector<std::vector<ParameterBlock<Scalar>>> replica_blocks(n_replicas);
+    std::vector<Scalar> weights(n_replicas);
+    std::vector<Eigen::Index> offsets(n_replicas), widths(n_replicas);
+    const auto shards = static_cast<Eigen::Index>(n_replicas);
+    for (size_t r = 0; r < n_replicas; ++r) {
+        const auto shard = static_cast<Eigen::Index>(r);
+        replica_blocks[r] = replicas[r].parameter_blocks();
+        offsets[r] = shard * width / shards;
+        widths[r] = (shard + 1) * width / shards - offsets[r];
+        weights[r] = static_cast<Scalar>(static_cast<double>(widths[r]) / batch);
+    }
+    std::vector<double> losses(n_replicas, 0), hits(n_replicas, 0);
+
+    // every replica copies the current parameters, gathers its shard and computes its gradients
+    team.run([&](const size_t worker) {
+        const auto began = std::chrono::steady_clock::now();
+        WorkerStats &own = stats[worker];
+        for (size_t r = worker; r < n_replicas; r += workers) {
+            Model &copy = replicas[r];
+            for (size_t i = 0; i < blocks.size(); ++i) {
+                std::copy_n(blocks[i].values, blocks[i].size, replica_blocks[r][i].values);
+            }
+            gather_columns(start + offsets[r], copy.batch_data, copy.batch_labels);
+            copy.set_step_width(widths[r]);
+            const auto labels = copy.batch_labels.leftCols(widths[r]);
+            copy.train_step(copy.batch_data.leftCols(widths[r]), labels, learning_rate);
+            const auto shard = static_cast<double>(widths[r]);
+            losses[r] = copy.dense_layers.back().getLoss() * shard;
+            hits[r] = copy.calc_accuracy(copy.dense_layers.back().getAValues(), labels) * shard;
+            ++own.steps;
+            own.samples += shard;
+            own.loss += losses[r];
+            own.correct += hits[r];
         }
+        own.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+    });
 
-        if (verbose) {
-            accuracy = calc_accuracy(predict_after_forward_prop(), train_labels) * 100;
-            bar.set_option(indicators::option::PrefixText{"DeepDendro epoch: " + std::to_string(i + 1) + out_of_all});
-            bar.tick();
-            bar.set_option(indicators::option::PostfixText{
-                    "Loss function: " +
-                    std::to_string(lossFunc().categoryCrossEntropy(dense_layers.back().getAValues(), train_labels)) +
-                    ", Accuracy: " + std::to_string(accuracy) + "%"});
+    // Each worker sums the gradients of its range of the parameters, concatenated, over the replicas
+    // (in their order, whatever the number of workers) and updates that range. The ranges are cut at
+    // multiples of update_block within every parameter: the vectorized loops and their scalar tails
+    // (which round differently under FMA) then cover the same elements for any number of workers.
+    Eigen::Index total = 0;
+    for (const auto &block: blocks) {
+        total += block.size;
+    }
+    constexpr Eigen::Index align = Optimizer<Scalar>::update_block;
+    auto cut = [](const Eigen::Index offset, const Eigen::Index size) {
+        return std::clamp((offset + align - 1) / align * align, Eigen::Index(0), size);
+    };
+    team.run([&](const size_t worker) {
+        const auto began = std::chrono::steady_clock::now();
+        const Eigen::Index first = static_cast<Eigen::Index>(worker) * total / static_cast<Eigen::Index>(workers);
+        const Eigen::Index last = static_cast<Eigen::Index>(worker + 1) * total / static_cast<Eigen::Index>(workers);
+        Eigen::Index block_start = 0;
+        for (size_t i = 0; i < blocks.size() && block_start < last; block_start += blocks[i].size, ++i) {
+            const ParameterBlock<Scalar> &block = blocks[i];
+            const Eigen::Index begin = cut(first - block_start, block.size);
+            const Eigen::Index end = cut(last - block_start, block.size);
+            if (begin >= end) {
+                continue;
+            }
+            Eigen::Map<Array> sum(block.gradient + begin, end - begin);
+            sum = weights[0] * Eigen::Map<const Array>(replica_blocks[0][i].gradient + begin, end - begin);
+            for (size_t r = 1; r < n_replicas; ++r) {
+                sum += weights[r] * Eigen::Map<const Array>(replica_blocks[r][i].gradient + begin, end - begin);
+            }
+            block.optimizer->update_range(block.values, block.gradient, *block.slot, learning_rate, block.decay,
+                                          begin, end);
+            if (block.mask != nullptr) {
+                Eigen::Map<Array>(block.values + begin, end - begin) *=
+                        Eigen::Map<const Array>(block.mask + begin, end - begin);
+            }
+        }
+        stats[worker].seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+    });
+
+    if (loss != nullptr) {
+        for (size_t r = 0; r < n_replicas; ++r) {
+            *loss += losses[r];
+            *correct += hits[r];
+        }
+    }
+}
+
+template<typename Scalar>
+void Model<Scalar>::hogwild_epoch(WorkerTeam &team, const Eigen::Index batches, const double learning_rate,
+                                  WorkerStats *stats) {
+    using Array = Eigen::Array<Scalar, Eigen::Dynamic, 1>;
+    const std::vector<ParameterBlock<Scalar>> blocks = parameter_blocks();
+    std::vector<std::vector<ParameterBlock<Scalar>>> replica_blocks(replicas.size());
+    for (size_t r = 0; r < replicas.size(); ++r) {
+        replica_blocks[r] = replicas[r].parameter_blocks();
+    }
+    Eigen::Index total = 0;
+    for (const auto &block: blocks) {
+        total += block.size;
+    }
+    static_assert(std::atomic_ref<Scalar>::required_alignment == alignof(Scalar));
+    std::atomic<Eigen::Index> next{0};
+
+    // The workers share the parameters without locks. A worker reads them one by one into its replica, trains
+    // on that snapshot and updates it with its own optimizer state, then adds the difference to the shared
+    // parameters one by one. The reads and adds are relaxed atomic operations: no update is lost, but a
+    // snapshot may mix values from before and after the updates of other workers, the staleness Hogwild
+    // relies on being small when the updates are small and spread over many parameters.
+    team.run([&](const size_t worker) {
+        const auto began = std::chrono::steady_clock::now();
+        Model &copy = replicas[worker];
+        const std::vector<ParameterBlock<Scalar>> &own = replica_blocks[worker];
+        const Eigen::Index batch = copy.batch_data.cols();
+        std::vector<Scalar> snapshot(static_cast<size_t>(total));
+        for (Eigen::Index b = next.fetch_add(1, std::memory_order_relaxed); b < batches;
+             b = next.fetch_add(1, std::memory_order_relaxed)) {
+            Scalar *read = snapshot.data();
+            for (size_t i = 0; i < blocks.size(); read += blocks[i].size, ++i) {
+                for (Eigen::Index j = 0; j < blocks[i].size; ++j) {
+                    read[j] = std::atomic_ref<Scalar>(blocks[i].values[j]).load(std::memory_order_relaxed);
+                }
+                std::copy_n(read, blocks[i].size, own[i].values);
+            }
+            const Eigen::Index width = gather_columns(b * batch, copy.batch_data, copy.batch_labels);
+            copy.set_step_width(width);
+            const auto labels = copy.batch_labels.leftCols(width);
+            copy.train_step(copy.batch_data.leftCols(width), labels, learning_rate);
+
+            // the worker's own optimizer state and copy of the parameters
+            for (auto &conv: copy.conv_layers) {
+                conv.begin_update();
+            }
+            for (auto &layer: copy.dense_layers) {
+                layer.begin_update();
+            }
+            read = snapshot.data();
+            for (size_t i = 0; i < blocks.size(); read += blocks[i].size, ++i) {
+                own[i].optimizer->update_range(own[i].values, own[i].gradient, *own[i].slot, learning_rate,
+                                               own[i].decay, 0, own[i].size);
+                if (blocks[i].mask != nullptr) {
+                    Eigen::Map<Array>(own[i].values, own[i].size) *=
+                            Eigen::Map<const Array>(blocks[i].mask, blocks[i].size);
+                }
+                for (Eigen::Index j = 0; j < blocks[i].size; ++j) {
+                    const Scalar delta = own[i].values[j] - read[j];
+                    if (delta != 0) {
+                        std::atomic_ref<Scalar>(blocks[i].values[j]).fetch_add(delta, std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            const auto samples = static_cast<double>(width);
+            ++stats[worker].steps;
+            stats[worker].samples += samples;
+            stats[worker].loss += copy.dense_layers.back().getLoss() * samples;
+            stats[worker].correct += copy.calc_accuracy(copy.dense_layers.back().getAValues(), labels) * samples;
+        }
+        stats[worker].seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+    });
+}
+
+template<typename Scalar>
+void Model<Scalar>::train(size_t epochs, double learning_rate, const bool verbose, const size_t batch_size) {
+    if (!has_output_layer) {
+        addDense(train_labels->rows(), activation::softmax);
+        has_output_layer = true;
+    }
+
+    store_train_data();
+    const Eigen::Index n_samples = train_samples();
+    const bool full_batch = batch_size == 0 || batch_size >= static_cast<size_t>(n_samples);
+    const Eigen::Index batch = full_batch ? n_samples : static_cast<Eigen::Index>(batch_size);
+    const Eigen::Index batches_per_epoch = (n_samples + batch - 1) / batch;
+    const bool parallel = data_parallel.asynchronous || data_parallel.worker_count() > 1 || data_parallel.shards > 1;
+    // a 16-bit training set is converted batch by batch, the full batch included; data-parallel
+    // replicas gather their own shards
+    const bool gather = !full_batch || train_data_format != storage_format::native || parallel;
+    if (gather && permutation.size() != n_samples) {
+        permutation.resize(n_samples);
+        std::iota(permutation.begin(), permutation.end(), 0);
+    }
+
+    batch_data.resize(train_features(), batch);
+    batch_labels.resize(train_labels->rows(), batch);
+    if (!optimizers_set) {
+        for (auto &layer: dense_layers) {
+            layer.set_optimizer(optimizer_config);
+        }
+        for (auto &conv: conv_layers) {
+            conv.set_optimizer(optimizer_config);
+        }
+        optimizers_set = true;
+    }
+    std::optional<WorkerTeam> team;
+    if (parallel) {
+        team.emplace(data_parallel.worker_count());
+        make_replicas(batch);
+    } else {
+        plan_training_memory(batch);
+    }
+
+    // loss and accuracy of every step come out of the forward pass the step already did,
+    // aggregating and printing them is left to the reporter thread
+    std::optional<MetricsReporter> reporter;
+    if (verbose) {
+        reporter.emplace(epochs, report_options);
+    }
+    const bool validate = verbose && report_options.eval_every_epochs != 0 && validation_data->cols() != 0;
+    const size_t total_steps = epochs * static_cast<size_t>(batches_per_epoch);
+    const size_t pruned_layers = dense_layers.size() - (pruning_config.prune_output_layer ? 0 : 1);
+    auto prune = [&](const size_t step) {
+        const double sparsity = pruning_sparsity(pruning_config, step, total_steps);
+        for (size_t k = 0; k < pruned_layers; ++k) {
+            dense_layers[k].prune(sparsity, pruning_config.block_rows);
+        }
+    };
+    worker_stats.clear();
+    if (parallel) {
+        worker_stats.reserve(epochs * team->size());
+    }
 
+    for (size_t i = 0; i < epochs; ++i) {
+        if (!full_batch) {
+            create_mini_batches();
+        }
+        // the epoch's totals, which the reporter writes the epoch summary from even if it dropped steps
+        double epoch_loss = 0, epoch_correct = 0, epoch_samples = 0;
+        WorkerStats *stats = nullptr;
+        if (parallel) {
+            for (size_t w = 0; w < team->size(); ++w) {
+                worker_stats.push_back({i, w});
+            }
+            stats = &worker_stats[worker_stats.size() - team->size()];
         }
 
-        // calc back_prop
-        gradient = dense_layers.back().calc_first_back_prop(train_labels);
-        // all other back props
-        for (int j = dense_layers.size() - 2; j > -1; j--) {
-            gradient = dense_layers[j].calc_back_prop(gradient);
+        if (data_parallel.asynchronous) {
+            hogwild_epoch(*team, batches_per_epoch, learning_rate, stats);
+            // the workers do not stop between their steps: the layers are pruned after the epoch, to the
+            // sparsity of its last pruning step
+            const size_t first_step = i * static_cast<size_t>(batches_per_epoch);
+            for (size_t step = first_step + static_cast<size_t>(batches_per_epoch); step-- > first_step;) {
+                if (pruning_step(pruning_config, step, total_steps)) {
+                    prune(step);
+                    break;
+                }
+            }
+            // one training event per worker that trained a batch, at the epoch's last step
+            if (reporter) {
+                for (size_t w = 0; w < team->size(); ++w) {
+                    if (stats[w].steps == 0) {
+                        continue;
+                    }
+                    reporter->push({MetricsEvent::training, i, static_cast<size_t>(batches_per_epoch) - 1,
+                                    stats[w].mean_loss(), stats[w].correct, stats[w].samples, w});
+                    epoch_loss += stats[w].loss;
+                    epoch_correct += stats[w].correct;
+                    epoch_samples += stats[w].samples;
+                }
+            }
+        } else {
+            for (Eigen::Index b = 0; b < batches_per_epoch; ++b) {
+                double loss = 0, correct = 0;
+                // the last batch is short when the batch size does not divide the training set
+                const Eigen::Index width = std::min(batch, n_samples - b * batch);
+                if (parallel) {
+                    data_parallel_step(*team, b * batch, learning_rate, reporter ? &loss : nullptr, &correct, stats);
+                } else {
+                    if (gather) {
+                        load_mini_batch(b * batch);
+                        set_step_width(width);
+                    }
+                    const Matrix &data = gather ? batch_data : *train_data;
+                    const auto labels = (gather ? batch_labels : *train_labels).leftCols(width);
+
+                    train_step(data.leftCols(width), labels, learning_rate);
+                    // the head has filled the output probabilities and the loss, the update does not touch them
+                    if (reporter) {
+                        loss = dense_layers.back().getLoss() * static_cast<double>(width);
+                        correct = calc_accuracy(dense_layers.back().getAValues(), labels) * static_cast<double>(width);
+                    }
+                }
+
+                const size_t step = i * static_cast<size_t>(batches_per_epoch) + static_cast<size_t>(b);
+                if (pruning_step(pruning_config, step, total_steps)) {
+                    prune(step);
+                }
+
+                if (reporter) {
+                    reporter->push({MetricsEvent::training, i, static_cast<size_t>(b), loss / static_cast<double>(width),
+                                    correct, static_cast<double>(width)});
+                    epoch_loss += loss;
+                    epoch_correct += correct;
+                    epoch_samples += static_cast<double>(width);
+                }
+            }
+        }
+        if (reporter) {
+            reporter->push({MetricsEvent::epoch_end, i, static_cast<size_t>(batches_per_epoch),
+                            epoch_samples > 0 ? epoch_loss / epoch_samples : 0, epoch_correct, epoch_samples});
         }
 
-        // here order doesn't really matter
-        dense_layers.front().apply_back_prop(learning_rate, train_data);
-        for (int j = 1; j < dense_layers.size(); j++) {
-            dense_layers[j].apply_back_prop(learning_rate, dense_layers[j - 1].getAValues());
+        if (validate && (i + 1) % report_options.eval_every_epochs == 0) {
+            const ClassificationMetrics metrics = evaluate(*validation_data, *validation_labels);
+            reporter->push({MetricsEvent::evaluation, i, static_cast<size_t>(batches_per_epoch), 0,
+                            metrics.accuracy() * static_cast<double>(metrics.samples()),
+                            static_cast<double>(metrics.samples())});
         }
     }
 }
 
-MatrixXd Model::predict_after_forward_prop() {
-    // TODO: Use vectorization
-    MatrixXd predicted_values = dense_layers.back().getAValues();
-    Eigen::Index numCols = predicted_values.cols();
-    int maxRowIndex;
-    for (Eigen::Index i = 0; i < numCols; i++) {
-        predicted_values.col(i).maxCoeff(&maxRowIndex);
-        predicted_values.col(i).setZero();
-        predicted_values(maxRowIndex, i) = 1;
+template<typename Scalar>
+MatrixT<Scalar> Model<Scalar>::predict(const Matrix &testData) const {
+    Matrix predicted_values = Matrix::Zero(dense_layers.back().shape.first, testData.cols());
+    const std::vector<int> classes = predict_classes(testData);
+    for (Eigen::Index i = 0; i < testData.cols(); i++) {
+        predicted_values(classes[i], i) = 1;
     }
     return predicted_values;
 }
 
-MatrixXd Model::predict(const MatrixXd &testData) {
-    dense_layers[0].forward_prop(testData);
-    for (int k = 1; k < dense_layers.size(); k++) {
-        dense_layers[k].forward_prop(dense_layers[k - 1].getAValues());
+template<typename Scalar>
+InferenceContext<Scalar> Model<Scalar>::make_inference_context(const Eigen::Index chunk) const {
+    if (chunk < 1) {
+        throw std::invalid_argument("Model::make_inference_context: chunk must be at least 1");
+    }
+    InferenceContext<Scalar> context;
+    context.chunk = chunk;
+    context.gemms.resize(dense_layers.size());
+
+    Eigen::Index widest = 0;
+    for (size_t k = 0; k < dense_layers.size(); k++) {
+        const auto neurons = static_cast<Eigen::Index>(dense_layers[k].shape.first);
+        widest = std::max(widest, neurons);
+        context.gemms[k].reserve(neurons, chunk, dense_layers[k].getInputSize());
+    }
+    for (const auto &conv: conv_layers) {
+        widest = std::max(widest, conv.getOutputSize());
     }
-    return predict_after_forward_prop();
+    for (const auto &pool: pool_layers) {
+        widest = std::max(widest, pool.getOutputSize());
+    }
+    context.ping.resize(widest, chunk);
+    context.pong.resize(widest, chunk);
+    return context;
 }
 
-double Model::calc_accuracy(const MatrixXd &predicted, const MatrixXd &true_labels, bool verbose) {
-    double num_samples = predicted.cols();
+template<typename Scalar>
+template<typename OnChunk>
+void Model<Scalar>::infer_scores(const Eigen::Ref<const Matrix> &data, InferenceContext<Scalar> &context,
+                                 OnChunk on_chunk) const {
+    const size_t last = dense_layers.size() - 1;
+    // softmax is monotonic, the argmax / top-k of the logits is that of the probabilities
+    const bool skip_output_activation = dense_layers.back().getActivation() == activation::softmax;
+
+    for (Eigen::Index start = 0; start < data.cols(); start += context.chunk) {
+        const Eigen::Index width = std::min(context.chunk, data.cols() - start);
+        Matrix *in = &context.ping;
+        Matrix *out = &context.pong;
+        // the first layer, stage or dense, reads the data itself
+        bool from_data = true;
+        auto input = [&](const Eigen::Index rows) -> Eigen::Ref<const Matrix> {
+            if (from_data) {
+                return data.middleCols(start, width);
+            }
+            return in->topLeftCorner(rows, width);
+        };
+
+        for (size_t k = 0; k < stages.size(); k++) {
+            const auto [type, index] = stages[k];
+            if (type == CONVOLUTION) {
+                const auto &conv = conv_layers[index];
+                conv.infer(input(conv.getInputSize()), out->topLeftCorner(conv.getOutputSize(), width));
+            } else {
+                const auto &pool = pool_layers[index];
+                pool.infer(input(pool.getInputSize()), out->topLeftCorner(pool.getOutputSize(), width));
+            }
+            from_data = false;
+            std::swap(in, out);
+        }
+
+        for (size_t k = 0; k <= last; k++) {
+            const auto &layer = dense_layers[k];
+            const auto neurons = static_cast<Eigen::Index>(layer.shape.first);
+            layer.infer(input(layer.getInputSize()), out->topLeftCorner(neurons, width), context.gemms[k],
+                        !(k == last && skip_output_activation));
+            from_data = false;
+            std::swap(in, out);
+        }
+
+        on_chunk(start, std::as_const(*in).topLeftCorner(dense_layers.back().shape.first, width));
+    }
+}
+
+template<typename Scalar>
+std::vector<int> Model<Scalar>::predict_classes(const Eigen::Ref<const Matrix> &data) const {
+    InferenceContext<Scalar> context = make_inference_context();
+    return predict_classes(data, context);
+}
+
+template<typename Scalar>
+std::vector<int> Model<Scalar>::predict_classes(const Eigen::Ref<const Matrix> &data,
+                                                InferenceContext<Scalar> &context) const {
+    std::vector<int> classes(data.cols());
+    infer_scores(data, context, [&classes](const Eigen::Index first, const auto &scores) {
+        Eigen::Index best;
+        for (Eigen::Index i = 0; i < scores.cols(); i++) {
+            scores.col(i).maxCoeff(&best);
+            classes[first + i] = static_cast<int>(best);
+        }
+    });
+    return classes;
+}
+
+template<typename Scalar>
+std::vector<int> Model<Scalar>::predict_top_k(const Eigen::Ref<const Matrix> &data, const size_t k) const {
+    InferenceContext<Scalar> context = make_inference_context();
+    return predict_top_k(data, k, context);
+}
+
+template<typename Scalar>
+std::vector<int> Model<Scalar>::predict_top_k(const Eigen::Ref<const Matrix> &data, size_t k,
+                                              InferenceContext<Scalar> &context) const {
+    const auto n_classes = static_cast<size_t>(dense_layers.back().shape.first);
+    // as ClassificationMetrics clamps its k
+    k = std::clamp<size_t>(k, 1, n_classes);
+
+    std::vector<int> top_k(data.cols() * k);
+    std::vector<int> order(n_classes);
+    infer_scores(data, context, [&](const Eigen::Index first, const auto &scores) {
+        for (Eigen::Index i = 0; i < scores.cols(); i++) {
+            std::iota(order.begin(), order.end(), 0);
+            std::partial_sort(order.begin(), order.begin() + k, order.end(),
+                              [&](int a, int b) { return scores(a, i) > scores(b, i); });
+            std::copy_n(order.begin(), k, top_k.begin() + (first + i) * k);
+        }
+    });
+    return top_k;
+}
+
+template<typename Scalar>
+void Model<Scalar>::evaluate_range(const Eigen::Ref<const Matrix> &data, const Eigen::Ref<const Matrix> &labels,
+                                   ClassificationMetrics &metrics) const {
+    const auto n_classes = static_cast<size_t>(dense_layers.back().shape.first);
+    // at most n_classes, as add_top_k reads k() entries of order
+    const size_t k = metrics.k();
+    std::vector<int> order(n_classes);
+    InferenceContext<Scalar> context = make_inference_context();
+
+    infer_scores(data, context, [&](const Eigen::Index first, const auto &scores) {
+        Eigen::Index label;
+        for (Eigen::Index i = 0; i < scores.cols(); i++) {
+            labels.col(first + i).maxCoeff(&label);
+            std::iota(order.begin(), order.end(), 0);
+            std::partial_sort(order.begin(), order.begin() + k, order.end(),
+                              [&](int a, int b) { return scores(a, i) > scores(b, i); });
+            metrics.add_top_k(order.data(), static_cast<int>(label));
+        }
+    });
+}
 
-    MatrixXd diff = (predicted - true_labels).cwiseAbs2();
+template<typename Scalar>
+ClassificationMetrics Model<Scalar>::evaluate(const Matrix &data, const Matrix &labels, const size_t top_k,
+                                              size_t num_threads) const {
+    const auto n_classes = static_cast<int>(dense_layers.back().shape.first);
+    const Eigen::Index n_samples = data.cols();
+    num_threads = std::max<size_t>(1, std::min<size_t>(num_threads, n_samples));
+    const Eigen::Index per_thread = (n_samples + static_cast<Eigen::Index>(num_threads) - 1) /
+                                    static_cast<Eigen::Index>(num_threads);
 
-    VectorXd col_sums = diff.colwise().sum();
-    double num_identical_cols = (col_sums.array() == 0).count();
+    std::vector<ClassificationMetrics> partial(num_threads, ClassificationMetrics(n_classes, top_k));
+    std::vector<std::thread> workers;
+    workers.reserve(num_threads);
+    for (size_t t = 0; t < num_threads; t++) {
+        const Eigen::Index start = static_cast<Eigen::Index>(t) * per_thread;
+        const Eigen::Index size = std::min(per_thread, n_samples - start);
+        if (size <= 0) break;
+        workers.emplace_back([&, t, start, size] {
+            evaluate_range(data.middleCols(start, size), labels.middleCols(start, size), partial[t]);
+        });
+    }
+    for (auto &worker: workers) {
+        worker.join();
+    }
+
+    // pairwise reduction: 0 <- 1, 2 <- 3, ..., then 0 <- 2, ...
+    for (size_t stride = 1; stride < num_threads; stride *= 2) {
+        for (size_t t = 0; t + stride < num_threads; t += 2 * stride) {
+            partial[t].merge(partial[t + stride]);
+        }
+    }
+    return partial[0];
+}
+
+template<typename Scalar>
+double Model<Scalar>::calc_accuracy(const Eigen::Ref<const Matrix> &predicted, const Eigen::Ref<const Matrix> &true_labels,
+                                    bool verbose) const {
+    double num_samples = predicted.cols();
+
+    // compares the hot indices column by column instead of building a difference matrix
+    Eigen::Index predicted_class, true_class;
+    double num_identical_cols = 0;
+    for (Eigen::Index i = 0; i < predicted.cols(); i++) {
+        predicted.col(i).maxCoeff(&predicted_class);
+        true_labels.col(i).maxCoeff(&true_class);
+        num_identical_cols += predicted_class == true_class;
+    }
 
     if (verbose) {
         std::cout << YELLOW << "Test accuracy: " << 100 * num_identical_cols / num_samples << "%" << RESET << std::endl;
     }
 
     return num_identical_cols / num_samples;
-}
\ No newline at end of file
+}
+
+template<typename Scalar>
+const std::vector<WorkerStats> &Model<Scalar>::getWorkerStats() const {
+    return worker_stats;
+}
+
+template<typename Scalar>
+const MemoryPlan &Model<Scalar>::getMemoryPlan() const {
+    return memory_plan;
+}
+
+template<typename Scalar>
+double Model<Scalar>::epochCost() const {
+    // a convolution costs one multiply-add per kernel weight and output; the backward pass takes
+    // about two forward passes
+    double per_sample = 0;
+    for (const auto &conv: conv_layers) {
+        per_sample += static_cast<double>(conv.getOutputSize()) *
+                      static_cast<double>(conv.getFilters().front().get_kernel().size());
+    }
+    for (const auto &layer: dense_layers) {
+        per_sample += static_cast<double>(layer.getWeights().size());
+    }
+    if (!has_output_layer) {
+        Eigen::Index last = has_tensor_input ? current_shape[0] * current_shape[1] * current_shape[2]
+                                             : train_features();
+        if (!dense_layers.empty()) {
+            last = dense_layers.back().shape.first;
+        }
+        per_sample += static_cast<double>(last) * static_cast<double>(train_labels->rows());
+    }
+    return 3 * per_sample * static_cast<double>(train_samples());
+}
+
+template<typename Scalar>
+const std::vector<HiddenLayer<Scalar>> &Model<Scalar>::getDenseLayers() const {
+    return dense_layers;
+}
+
+template<typename Scalar>
+size_t Model<Scalar>::getStageCount() const {
+    return stages.size();
+}
+
+template<typename Scalar>
+const std::vector<std::pair<StageType, size_t>> &Model<Scalar>::getStages() const {
+    return stages;
+}
+
+template<typename Scalar>
+const std::vector<Convolutional3D<Scalar>> &Model<Scalar>::getConvLayers() const {
+    return conv_layers;
+}
+
+template<typename Scalar>
+const std::vector<MaxPool3D<Scalar>> &Model<Scalar>::getPoolLayers() const {
+    return pool_layers;
+}
+
+template class Model<float>;
+template class Model<double>;
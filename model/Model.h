@@ -8,36 +8,322 @@
 #define RESET   "\033[0m"
 
 #include <iostream>
+#include <memory>
+#include <random>
+#include <array>
 #include "Layers.h"
 #include "vector"
 #include "activationFuncs.h"
 #include "lossFunc.h"
 #include "logging.h"
+#include "MetricsReporter.h"
 #include "Convolutions.h"
+#include "Pooling.h"
+#include "InferenceContext.h"
+#include "MemoryPlanner.h"
+#include "LowPrecision.h"
+#include "Pruning.h"
+#include "data_parallel.h"
+#include "accuracy.h"
 
+// (height, width, channels) of one sample
+using TensorShape = Eigen::array<Eigen::Index, 3>;
+
+enum StageType {
+    CONVOLUTION,
+    POOLING
+};
+
+template<typename Scalar = double>
 class Model {
-    std::vector<HiddenLayer> dense_layers;
-    MatrixXd train_data{};
-    MatrixXd train_labels;
+    using Matrix = MatrixT<Scalar>;
+    using Vector = VectorT<Scalar>;
+
+    // Convolutional front of the network, run before the dense layers. Samples stay columns all the way:
+    // every stage reads and writes flattened (height, width, channels) tensors, so the output of the
+    // last stage is the input of the first dense layer as it is and flattening costs nothing.
+    std::vector<std::pair<StageType, size_t>> stages;
+    std::vector<Convolutional3D<Scalar>> conv_layers;
+    std::vector<MaxPool3D<Scalar>> pool_layers;
+    // shape of one sample after the stages added so far, inferred as the model is built
+    TensorShape current_shape{};
+    bool has_tensor_input = false;
+    bool flattened = false;
+
+    std::vector<HiddenLayer<Scalar>> dense_layers;
+    // The training set is read-only and shared: copies of the model (the jobs of an InterModel, for one)
+    // reference the same matrices instead of duplicating them
+    std::shared_ptr<const Matrix> train_data = std::make_shared<const Matrix>();
+    std::shared_ptr<const Matrix> train_labels = std::make_shared<const Matrix>();
+    // the training set in 16 bits under mixed precision, the model lets go of train_data then; shared
+    // between copies like train_data, it is packed once by the model the copies were made from
+    std::shared_ptr<const Eigen::Matrix<std::uint16_t, Eigen::Dynamic, Eigen::Dynamic>> packed_train_data;
+
+    // mini-batches are gathered through a permutation of the column indices,
+    // so train_data itself is never copied or reordered
+    Eigen::VectorX<Eigen::Index> permutation;
+    Matrix batch_data;
+    Matrix batch_labels;
+    // samples of the current step: the batch size, fewer for the last batch of an epoch when the batch
+    // size does not divide the training set. The buffers keep their size, a short step uses their first
+    // columns.
+    Eigen::Index step_width = 0;
+    std::mt19937 rng{std::random_device{}()};
+
+    // one arena for the activations and gradients of a training step, laid out by memory_plan
+    WorkspaceStorage<Scalar> arena;
+    MemoryPlan memory_plan;
+
+    // where a unit (a stage or a dense layer) keeps its buffers in the arena; `saved` is what the forward
+    // pass keeps for the backward one besides the output (a ReLU mask), `packed` the output in 16 bits
+    // under mixed precision. Null for the buffers a unit never uses.
+    struct UnitWorkspace {
+        Scalar *saved;
+        Scalar *a;
+        Scalar *delta;
+        Scalar *gradient;
+        Scalar *packed;
+    };
+    // Checkpointing: a kept unit's forward buffers live until its backward pass. The others are dropped
+    // after the forward sweep and recomputed in the backward sweep, in their backward_workspace.
+    CheckpointConfig checkpoint_config;
+    std::vector<bool> kept;
+    std::vector<UnitWorkspace> forward_workspace;
+    std::vector<UnitWorkspace> backward_workspace;
+    // Mixed precision: the kept units whose outputs wait for the backward sweep in 16 bits, restored
+    // into their backward_workspace when the sweep reaches them
+    MixedPrecisionConfig mixed_precision;
+    std::vector<bool> packed;
+    std::uint64_t rounding_state = 0;
+    // how packed_train_data was stored
+    storage_format train_data_format = storage_format::native;
+    PruningConfig pruning_config;
+    // Data parallelism: every batch is split between the replicas, copies of the layers that train one
+    // shard each and only compute gradients (`replica` is set in them); the model sums the gradients and
+    // updates its own layers. Asynchronous training has one replica per worker, which applies its own
+    // updates to the model's parameters.
+    DataParallelConfig data_parallel;
+    std::vector<Model> replicas;
+    bool replica = false;
+    // every worker's figures in every epoch of the last data-parallel train(), epoch by epoch
+    std::vector<WorkerStats> worker_stats;
+
+    OptimizerConfig optimizer_config;
+    // the first train() call adds the output layer and sets the layers' optimizers up; later calls
+    // continue from there, with the optimizer state, unless setOptimizer changed the rule
+    bool has_output_layer = false;
+    bool optimizers_set = false;
+    precision activation_precision = precision::exact;
+    ReportOptions report_options;
+    std::shared_ptr<const Matrix> validation_data = std::make_shared<const Matrix>();
+    std::shared_ptr<const Matrix> validation_labels = std::make_shared<const Matrix>();
 
-    MatrixXd predict_after_forward_prop();
     void create_mini_batches();
+    // returns the number of samples of the batch
+    Eigen::Index load_mini_batch(Eigen::Index start);
+
+    // up to data.cols() samples, from position `start` of the permutation on, into the first columns of
+    // data and labels; returns how many there were before the end of the permutation
+    Eigen::Index gather_columns(Eigen::Index start, Matrix &data, Matrix &labels) const;
+
+    // rebinds every unit's buffers to steps of `width` samples, within the planned arena
+    void set_step_width(Eigen::Index width);
+
+    // one replica per shard of a batch of `batch` samples, each with its own arena
+    void make_replicas(Eigen::Index batch);
+
+    // every layer's parameter blocks, stages first, in the same order for the model and its replicas
+    std::vector<ParameterBlock<Scalar>> parameter_blocks();
+
+    // one data-parallel training step on the batch at position `start` of the permutation; adds the
+    // batch's summed loss and number of correct predictions to loss and correct if they are given, and
+    // every worker's work to stats[worker]
+    void data_parallel_step(WorkerTeam &team, Eigen::Index start, double learning_rate, double *loss,
+                            double *correct, WorkerStats *stats);
+
+    // one epoch of asynchronous (Hogwild) training: the workers pull the `batches` batches of the
+    // permutation one by one, every worker's work goes to stats[worker]
+    void hogwild_epoch(WorkerTeam &team, Eigen::Index batches, double learning_rate, WorkerStats *stats);
+
+    void forward_prop(const Matrix &data, bool training = false);
+
+    const MatrixMapT<Scalar> &stage_a_values(size_t k) const;
+
+    // output of unit u, a stage or a dense layer
+    const MatrixMapT<Scalar> &unit_a_values(size_t u) const;
+
+    // input of stage k: the data for the first one, else the output of the previous one
+    Eigen::Ref<const Matrix> stage_input(size_t k, const Eigen::Ref<const Matrix> &data) const;
+
+    // what the first dense layer reads: the data itself or the output of the last stage
+    Eigen::Ref<const Matrix> dense_input(const Eigen::Ref<const Matrix> &data) const;
+
+    // liveness analysis over one training step, then every layer's buffers are bound into `arena`
+    void plan_training_memory(Eigen::Index batch);
+
+    // plan of one training step keeping the forward buffers of the units in `keep`, in 16 bits if
+    // `half_storage`; slots (if given) gets every unit's request indices: saved, a, delta, gradient,
+    // saved and a of the recomputation (or restoration), packed output
+    MemoryPlan plan_step(Eigen::Index batch, const std::vector<bool> &keep, bool half_storage,
+                         std::vector<std::array<size_t, 7>> *slots) const;
+
+    // moves the training set into packed_train_data or back into train_data, as mixed_precision says;
+    // a packed set shared with other copies of the model is kept as it is
+    void store_train_data();
+
+    Eigen::Index train_samples() const;
+
+    Eigen::Index train_features() const;
+
+    // unit u's output into its 16-bit copy, and back into the output buffer of its backward_workspace
+    void pack_unit(size_t u);
+
+    void restore_unit(size_t u);
+
+    // the units to keep under checkpoint_config, all of them when checkpointing is off
+    std::vector<bool> choose_checkpoints(Eigen::Index batch) const;
+
+    void bind_unit(size_t u, const UnitWorkspace &workspace);
+
+    void forward_unit(size_t u, const Eigen::Ref<const Matrix> &data, bool training);
+
+    // backward pass and update of unit u, gradient is the one handed down by unit u + 1 and is replaced
+    // by the one for unit u - 1
+    void backward_unit(size_t u, const Eigen::Ref<const Matrix> &data, const Eigen::Ref<const Matrix> &labels,
+                       double learning_rate, const MatrixMapT<Scalar> *&gradient);
+
+    // runs the network chunk by chunk through the context's buffers and hands every chunk's
+    // raw output scores to on_chunk(first_sample, scores)
+    template<typename OnChunk>
+    void infer_scores(const Eigen::Ref<const Matrix> &data, InferenceContext<Scalar> &context, OnChunk on_chunk) const;
+
+    void evaluate_range(const Eigen::Ref<const Matrix> &data, const Eigen::Ref<const Matrix> &labels,
+                        ClassificationMetrics &metrics) const;
+    // forward sweep, backward sweep and update of one batch
+    void train_step(const Eigen::Ref<const Matrix> &data, const Eigen::Ref<const Matrix> &labels,
+                    double learning_rate);
 
 public:
     Model();
 
-    void addInput(const MatrixXd &data);
+    void addInput(const Matrix &data);
+
+    // every column of data is one sample, a (height, width, channels) tensor flattened in column-major order
+    void addInput(const Matrix &data, TensorShape sample_shape);
+
+    void addOutput(const Matrix &labels);
+
+    // the same with a training set other models may share, which is never copied
+    void addInput(std::shared_ptr<const Matrix> data);
+
+    void addInput(std::shared_ptr<const Matrix> data, TensorShape sample_shape);
+
+    void addOutput(std::shared_ptr<const Matrix> labels);
+
+    // Convolutional stages, only between an addInput with a sample shape and addFlatten.
+    // A kernel spans all channels of its input; the filters make the channels of the output.
+    void addConv(size_t n_filters, std::array<Eigen::Index, 2> kernel, activation activationType);
 
-    void addOutput(const MatrixXd &labels);
+    // max over grid windows of every channel
+    void addMaxPool(std::array<Eigen::Index, 2> grid, std::array<Eigen::Index, 2> stride);
+
+    // ends the convolutional stages, dense layers may follow
+    void addFlatten();
 
     // by default, we have a straight-forward model (no branching)
     void addDense(int neurons, activation activationType);
 
-    void train(size_t epochs = 10, double learning_rate = 0.005, bool verbose = true);
+    // update rule of every layer, plain SGD by default; the learning rate is still given to train()
+    void setOptimizer(const OptimizerConfig &config);
+
+    // exact (the default), fast or fastest exp/tanh in the sigmoid, tanh and softmax activations of
+    // every layer, for training and inference; the error bounds are listed in approxMath.h
+    void setPrecision(precision accuracy);
+
+    // held-out set evaluated during verbose training, every report_options.eval_every_epochs epochs
+    void addValidation(const Matrix &data, const Matrix &labels);
+
+    void addValidation(std::shared_ptr<const Matrix> data, std::shared_ptr<const Matrix> labels);
+
+    // opt-in activation recomputation: trades a second forward pass through some layers for a smaller
+    // training arena, see CheckpointConfig
+    void setCheckpointing(const CheckpointConfig &config);
+
+    // bf16 / fp16 storage of the kept activations and of the training set, see MixedPrecisionConfig; the
+    // training set is packed right away, copies of the model made afterwards share it
+    void setMixedPrecision(const MixedPrecisionConfig &config);
+
+    // gradual magnitude pruning of the dense layers during train(), see PruningConfig
+    void setPruning(const PruningConfig &config);
+
+    // training on several cores within this model, see DataParallelConfig
+    void setDataParallel(const DataParallelConfig &config);
+
+    // how verbose training reports its progress: bar refresh rate, CSV / JSONL log, evaluation cadence
+    void setReportOptions(const ReportOptions &options);
+
+    // batch_size == 0 (or >= number of samples) falls back to full-batch gradient descent. Every epoch
+    // trains every sample once: the last batch is shorter when batch_size does not divide the samples.
+    // With the default thread budget of one thread (execution::set_threads), the steps do no heap
+    // allocation once train() has set them up; Eigen's multithreaded products allocate.
+    // With verbose on, the per-step loss and accuracy are handed to a MetricsReporter thread.
+    // A later call trains the model further.
+    void train(size_t epochs = 10, double learning_rate = 0.005, bool verbose = true, size_t batch_size = 0);
+
+
+    // one-hot predictions, computed by the read-only inference path
+    Matrix predict(const Matrix &testData) const;
+
+    // Read-only inference: none of the layers' training buffers are touched, so these may be called
+    // concurrently from many threads on one shared model (as long as it is not being trained meanwhile).
+    // Every thread should own its context; the overloads without one create a temporary context.
+    // A context runs `chunk` samples at a time; throws std::invalid_argument if chunk < 1.
+    InferenceContext<Scalar> make_inference_context(Eigen::Index chunk = 256) const;
+
+    // index of the most probable class of every sample (column)
+    std::vector<int> predict_classes(const Eigen::Ref<const Matrix> &data) const;
+    std::vector<int> predict_classes(const Eigen::Ref<const Matrix> &data, InferenceContext<Scalar> &context) const;
+
+    // k most probable classes of every sample, best first: sample i occupies [i * k, (i + 1) * k); k is
+    // clamped to [1, number of classes] like ClassificationMetrics::k()
+    std::vector<int> predict_top_k(const Eigen::Ref<const Matrix> &data, size_t k) const;
+    std::vector<int> predict_top_k(const Eigen::Ref<const Matrix> &data, size_t k,
+                                   InferenceContext<Scalar> &context) const;
+
+    // accuracy, top-k accuracy, confusion matrix and per-class precision/recall of the model on a
+    // one-hot labelled set. The columns are split between num_threads inference threads, whose partial
+    // metrics are combined by a pairwise (tree) reduction; no N-column matrices are allocated.
+    ClassificationMetrics evaluate(const Matrix &data, const Matrix &labels, size_t top_k = 1,
+                                   size_t num_threads = 1) const;
+
+    double calc_accuracy(const Eigen::Ref<const Matrix> &predicted, const Eigen::Ref<const Matrix> &true_labels,
+                         bool verbose = false) const;
+
+    // estimated multiply-adds of one training epoch, forward and backward, the output layer included;
+    // for comparing the cost of models
+    double epochCost() const;
+
+    // what every worker did in every epoch of the last data-parallel train() call (throughput, loss,
+    // accuracy), epoch by epoch; empty after a serial one
+    const std::vector<WorkerStats> &getWorkerStats() const;
+
+    // layout of the training buffers chosen by the last train() call: planned vs naive peak,
+    // printable with operator<<. Data-parallel training plans one arena per replica, the plan is then
+    // that of the largest one (every worker's replica takes about as much).
+    const MemoryPlan &getMemoryPlan() const;
+
+    // dense layers in order, the softmax output layer included once the model has been trained
+    const std::vector<HiddenLayer<Scalar>> &getDenseLayers() const;
+
+    // number of convolutional and pooling stages in front of the dense layers
+    size_t getStageCount() const;
+
+    // the stages in order, each an index into getConvLayers() or getPoolLayers()
+    const std::vector<std::pair<StageType, size_t>> &getStages() const;
 
+    const std::vector<Convolutional3D<Scalar>> &getConvLayers() const;
 
-    MatrixXd predict(const MatrixXd &testData);
-    double calc_accuracy(const MatrixXd &predicted, const MatrixXd &true_labels, bool verbose = false);
+    const std::vector<MaxPool3D<Scalar>> &getPoolLayers() const;
 
     void test();
 
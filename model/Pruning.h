@@ -0,0 +1,50 @@
+#ifndef DEEPDENDRO_PRUNING_H
+#define DEEPDENDRO_PRUNING_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <Eigen/Core>
+
+// Gradual magnitude pruning of the dense layers during Model::train. Every `frequency` steps between
+// begin_step and end_step the smallest weights of each layer are set to zero until the layer reaches
+// the sparsity of the schedule; pruned weights stay zero through the later updates (masked updates).
+// The sparsity follows s(t) = target + (initial - target) (1 - progress)^3: fast pruning while the
+// network has redundant weights to spare, slow towards the end.
+struct PruningConfig {
+    bool enabled = false;
+    // fraction of the weights of every pruned layer that ends at zero
+    double target_sparsity = 0.9;
+    double initial_sparsity = 0;
+    // training steps (batches) counted from the start of train(); end_step 0 is the last step
+    size_t begin_step = 0;
+    size_t end_step = 0;
+    size_t frequency = 100;
+    // weights are pruned in blocks of this many neurons (rows) for one input, ranked by their summed
+    // magnitude; SparseWeights::block_rows makes the block-sparse kernel the fastest
+    Eigen::Index block_rows = 1;
+    bool prune_output_layer = false;
+};
+
+// sparsity of the schedule at `step` of a train() call of total_steps steps
+inline double pruning_sparsity(const PruningConfig &config, const size_t step, const size_t total_steps) {
+    const size_t end = config.end_step == 0 ? total_steps - 1 : config.end_step;
+    if (step < config.begin_step) {
+        return 0;
+    }
+    if (step >= end || end <= config.begin_step) {
+        return config.target_sparsity;
+    }
+    const double progress = static_cast<double>(step - config.begin_step) / static_cast<double>(end - config.begin_step);
+    return config.target_sparsity + (config.initial_sparsity - config.target_sparsity) * std::pow(1 - progress, 3);
+}
+
+// whether the layers are pruned after `step`
+inline bool pruning_step(const PruningConfig &config, const size_t step, const size_t total_steps) {
+    const size_t end = config.end_step == 0 ? total_steps - 1 : config.end_step;
+    return config.enabled && step >= config.begin_step && step <= end &&
+           ((step - config.begin_step) % std::max<size_t>(config.frequency, 1) == 0 || step == end);
+}
+
+
+#endif //DEEPDENDRO_PRUNING_H
@@ -0,0 +1,300 @@
+#include "QuantizedModel.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+    // the quantized x, then zeros up to `stride` bytes
+    template<typename Scalar>
+    void quantize(const Scalar *x, const Eigen::Index count, const Scalar inverse_scale, std::int8_t *q,
+                  const Eigen::Index stride) {
+        quantized::quantize(x, inverse_scale, count, q);
+        std::fill(q + count, q + stride, std::int8_t(0));
+    }
+}
+
+template<typename Scalar>
+QuantizedModel<Scalar>::QuantizedModel(const Model<Scalar> &model, const Eigen::Ref<const Matrix> &calibration) {
+    const auto &dense_layers = model.getDenseLayers();
+    if (dense_layers.empty()) {
+        throw std::invalid_argument("QuantizedModel: the model has no dense layers");
+    }
+    if (calibration.cols() == 0) {
+        throw std::invalid_argument("QuantizedModel: the calibration batch is empty");
+    }
+
+    for (const auto &[type, index]: model.getStages()) {
+        Unit unit;
+        if (type == CONVOLUTION) {
+            const auto &conv = model.getConvLayers()[index];
+            const auto &filters = conv.getFilters();
+            const auto &filter_shape = conv.getFilterShape();
+            unit.type = UnitType::conv;
+            unit.inputs = conv.getInputSize();
+            unit.outputs = conv.getOutputSize();
+            unit.input_stride = unit.inputs;
+            unit.input_shape = conv.getInputShape();
+            unit.kernel = {filter_shape[0], filter_shape[1]};
+            unit.activ_type = conv.getActivation();
+            unit.activ_precision = conv.getPrecision();
+
+            const Eigen::Index taps = filter_shape[0] * filter_shape[1] * filter_shape[2];
+            Matrix kernels(taps, static_cast<Eigen::Index>(filters.size()));
+            for (size_t f = 0; f < filters.size(); ++f) {
+                kernels.col(static_cast<Eigen::Index>(f)) = Eigen::Map<const Vector>(filters[f].get_kernel().data(), taps);
+            }
+            const Vector scales = quantize_weights(kernels, unit.weights);
+            unit.depth = unit.weights.rows();
+
+            // every filter fills a contiguous block of positions of the output
+            const Eigen::Index positions = unit.outputs / kernels.cols();
+            unit.output_scales.resize(unit.outputs);
+            unit.biases.resize(unit.outputs);
+            for (Eigen::Index f = 0; f < kernels.cols(); ++f) {
+                unit.output_scales.segment(f * positions, positions).setConstant(scales(f));
+                unit.biases.segment(f * positions, positions).setConstant(filters[f].get_bias());
+            }
+        } else {
+            const auto &pool = model.getPoolLayers()[index];
+            unit.type = UnitType::pool;
+            unit.inputs = pool.getInputSize();
+            unit.outputs = pool.getOutputSize();
+            unit.input_stride = unit.inputs;
+            unit.pool = pool_layers.size();
+            pool_layers.push_back(pool);
+        }
+        units.push_back(std::move(unit));
+    }
+
+    for (const auto &layer: dense_layers) {
+        Unit unit;
+        unit.type = UnitType::dense;
+        unit.inputs = layer.getInputSize();
+        unit.outputs = static_cast<Eigen::Index>(layer.shape.first);
+        unit.activ_type = layer.getActivation();
+        unit.activ_precision = layer.getPrecision();
+        // a neuron's weights are a row of the layer's matrix, a column here
+        unit.output_scales = quantize_weights(layer.getWeights().transpose(), unit.weights);
+        unit.depth = unit.weights.rows();
+        unit.input_stride = unit.depth;
+        unit.biases = layer.getBiases();
+        units.push_back(std::move(unit));
+    }
+    skip_output_activation = dense_layers.back().getActivation() == activation::softmax;
+
+    const std::vector<Scalar> ranges = calibrate(model, calibration);
+    for (size_t u = 0; u < units.size(); ++u) {
+        // a pooling neither changes the scale nor is able to: its int8 output is a subset of its input
+        if (u > 0 && units[u - 1].type == UnitType::pool) {
+            units[u].input_scale = units[u - 1].input_scale;
+        } else {
+            units[u].input_scale = ranges[u] > 0 ? ranges[u] / Scalar(127) : Scalar(1);
+        }
+        if (units[u].type != UnitType::pool) {
+            units[u].output_scales *= units[u].input_scale;
+        }
+    }
+}
+
+template<typename Scalar>
+VectorT<Scalar> QuantizedModel<Scalar>::quantize_weights(const Eigen::Ref<const Matrix> &weights,
+                                                         Int8Matrix &quantized) const {
+    quantized = Int8Matrix::Zero(quantized::padded_depth(weights.rows()), weights.cols());
+    Vector scales(weights.cols());
+    for (Eigen::Index c = 0; c < weights.cols(); ++c) {
+        const Scalar largest = weights.col(c).cwiseAbs().maxCoeff();
+        scales(c) = largest > 0 ? largest / Scalar(127) : Scalar(1);
+        quantized.col(c).head(weights.rows()) =
+                (weights.col(c).array() / scales(c)).round().template cast<std::int8_t>().matrix();
+    }
+    return scales;
+}
+
+template<typename Scalar>
+std::vector<Scalar> QuantizedModel<Scalar>::calibrate(const Model<Scalar> &model,
+                                                      const Eigen::Ref<const Matrix> &calibration) const {
+    // the float forward pass of Model::infer_scores, recording every unit's input on the way
+    const auto &stages = model.getStages();
+    const auto &dense_layers = model.getDenseLayers();
+    std::vector<Scalar> ranges(units.size(), Scalar(0));
+
+    Eigen::Index widest = 0;
+    for (const auto &unit: units) {
+        widest = std::max(widest, unit.outputs);
+    }
+    Matrix ping(widest, chunk), pong(widest, chunk);
+    GemmWorkspace<Scalar> gemm;
+
+    for (Eigen::Index start = 0; start < calibration.cols(); start += chunk) {
+        const Eigen::Index width = std::min(chunk, calibration.cols() - start);
+        Matrix *in = &ping;
+        Matrix *out = &pong;
+        bool from_data = true;
+        auto input = [&](const size_t u) -> Eigen::Ref<const Matrix> {
+            Eigen::Ref<const Matrix> x = from_data ? Eigen::Ref<const Matrix>(calibration.middleCols(start, width))
+                                                   : Eigen::Ref<const Matrix>(in->topLeftCorner(units[u].inputs, width));
+            ranges[u] = std::max(ranges[u], x.cwiseAbs().maxCoeff());
+            return x;
+        };
+
+        size_t u = 0;
+        for (const auto &[type, index]: stages) {
+            if (type == CONVOLUTION) {
+                model.getConvLayers()[index].infer(input(u), out->topLeftCorner(units[u].outputs, width));
+            } else {
+                model.getPoolLayers()[index].infer(input(u), out->topLeftCorner(units[u].outputs, width));
+            }
+            from_data = false;
+            std::swap(in, out);
+            ++u;
+        }
+        // the output layer's scores are not quantized
+        for (size_t k = 0; k + 1 < dense_layers.size(); ++k, ++u) {
+            const auto &layer = dense_layers[k];
+            gemm.reserve(units[u].outputs, width, layer.getInputSize());
+            layer.infer(input(u), out->topLeftCorner(units[u].outputs, width), gemm);
+            from_data = false;
+            std::swap(in, out);
+        }
+        input(u);
+    }
+    return ranges;
+}
+
+template<typename Scalar>
+void QuantizedModel<Scalar>::finish(const Unit &unit, const Int32Matrix &sums, const Eigen::Index width,
+                                    Vector &column, Int8Matrix *next, const Eigen::Index next_stride,
+                                    const Scalar next_scale, Eigen::Ref<Matrix> scores, const bool last) const {
+    const Scalar inverse_scale = Scalar(1) / next_scale;
+    act::dispatch(unit.activ_type, unit.activ_precision, [&](auto policy) {
+        for (Eigen::Index s = 0; s < width; ++s) {
+            auto y = column.head(unit.outputs);
+            y.array() = sums.col(s).head(unit.outputs).template cast<Scalar>().array() * unit.output_scales.array() +
+                        unit.biases.array();
+            if (last) {
+                if (!skip_output_activation) {
+                    act::activate<decltype(policy)>(y);
+                }
+                scores.col(s) = y;
+            } else {
+                act::activate<decltype(policy)>(y);
+                quantize(y.data(), unit.outputs, inverse_scale, next->data() + s * next_stride, next_stride);
+            }
+        }
+    });
+}
+
+template<typename Scalar>
+void QuantizedModel<Scalar>::run_unit(const size_t u, const Int8Matrix &input, const Eigen::Index width,
+                                      Int8Matrix &output, Eigen::Ref<Matrix> scores, Int32Matrix &sums,
+                                      Int8Matrix &patches, Vector &column) const {
+    const Unit &unit = units[u];
+    const bool last = u + 1 == units.size();
+    const Eigen::Index next_stride = last ? 0 : units[u + 1].input_stride;
+    const Scalar next_scale = last ? Scalar(1) : units[u + 1].input_scale;
+
+    switch (unit.type) {
+        case UnitType::dense:
+            quantized::gemm(unit.outputs, width, unit.depth, unit.weights.data(), input.data(), sums.data(),
+                            sums.rows());
+            finish(unit, sums, width, column, &output, next_stride, next_scale, scores, last);
+            break;
+
+        case UnitType::conv: {
+            const auto [rows, cols, channels] = unit.input_shape;
+            const auto [kernel_rows, kernel_cols] = unit.kernel;
+            const Eigen::Index out_rows = rows - kernel_rows + 1;
+            const Eigen::Index positions = out_rows * (cols - kernel_cols + 1);
+            for (Eigen::Index s = 0; s < width; ++s) {
+                // im2col: the window of every output position laid out like a kernel, (kh, kw, channels)
+                const std::int8_t *sample = input.data() + s * unit.input_stride;
+                for (Eigen::Index p = 0; p < positions; ++p) {
+                    const Eigen::Index i = p % out_rows, j = p / out_rows;
+                    std::int8_t *patch = patches.data() + p * unit.depth;
+                    for (Eigen::Index c = 0; c < channels; ++c) {
+                        for (Eigen::Index dj = 0; dj < kernel_cols; ++dj, patch += kernel_rows) {
+                            std::memcpy(patch, sample + i + rows * (j + dj + cols * c), kernel_rows);
+                        }
+                    }
+                }
+                // c(position, filter): the column-major layout of the output tensor
+                quantized::gemm(positions, unit.weights.cols(), unit.depth, patches.data(), unit.weights.data(),
+                                sums.data() + s * sums.rows(), positions);
+            }
+            finish(unit, sums, width, column, &output, next_stride, next_scale, scores, last);
+            break;
+        }
+
+        case UnitType::pool:
+            for (Eigen::Index s = 0; s < width; ++s) {
+                std::int8_t *out = output.data() + s * next_stride;
+                pool_layers[unit.pool].infer_sample(input.data() + s * unit.input_stride, out);
+                std::fill(out + unit.outputs, out + next_stride, std::int8_t(0));
+            }
+            break;
+    }
+}
+
+template<typename Scalar>
+MatrixT<Scalar> QuantizedModel<Scalar>::predict_scores(const Eigen::Ref<const Matrix> &data) const {
+    const Unit &first = units.front();
+    if (data.rows() != first.inputs) {
+        throw std::invalid_argument("QuantizedModel::predict_scores: the data has " + std::to_string(data.rows()) +
+                                    " rows, the model takes " + std::to_string(first.inputs));
+    }
+    Matrix scores(units.back().outputs, data.cols());
+
+    // activations ping-pong between two int8 buffers, samples `input_stride` bytes apart
+    Eigen::Index stride = 0, outputs = 0, patch_bytes = 0;
+    for (const auto &unit: units) {
+        stride = std::max(stride, unit.input_stride);
+        outputs = std::max(outputs, unit.outputs);
+        if (unit.type == UnitType::conv) {
+            patch_bytes = std::max(patch_bytes, unit.outputs / unit.weights.cols() * unit.depth);
+        }
+    }
+    // the padding of the patches is never written, so it stays zero
+    Int8Matrix ping(stride, chunk), pong(stride, chunk), patches = Int8Matrix::Zero(patch_bytes, 1);
+    Int32Matrix sums(outputs, chunk);
+    Vector column(outputs);
+
+    const Scalar inverse_scale = Scalar(1) / first.input_scale;
+    for (Eigen::Index start = 0; start < data.cols(); start += chunk) {
+        const Eigen::Index width = std::min(chunk, data.cols() - start);
+        for (Eigen::Index s = 0; s < width; ++s) {
+            quantize(data.col(start + s).data(), first.inputs, inverse_scale, ping.data() + s * first.input_stride,
+                     first.input_stride);
+        }
+        Int8Matrix *in = &ping;
+        Int8Matrix *out = &pong;
+        for (size_t u = 0; u < units.size(); ++u) {
+            run_unit(u, *in, width, *out, scores.middleCols(start, width), sums, patches, column);
+            std::swap(in, out);
+        }
+    }
+    return scores;
+}
+
+template<typename Scalar>
+std::vector<int> QuantizedModel<Scalar>::predict_classes(const Eigen::Ref<const Matrix> &data) const {
+    const Matrix scores = predict_scores(data);
+    std::vector<int> classes(scores.cols());
+    Eigen::Index best;
+    for (Eigen::Index i = 0; i < scores.cols(); ++i) {
+        scores.col(i).maxCoeff(&best);
+        classes[i] = static_cast<int>(best);
+    }
+    return classes;
+}
+
+template<typename Scalar>
+Eigen::Index QuantizedModel<Scalar>::weight_bytes() const {
+    Eigen::Index bytes = 0;
+    for (const auto &unit: units) {
+        bytes += unit.weights.size();
+    }
+    return bytes;
+}
+
+template class QuantizedModel<float>;
+template class QuantizedModel<double>;
@@ -0,0 +1,94 @@
+#ifndef DEEPDENDRO_QUANTIZEDMODEL_H
+#define DEEPDENDRO_QUANTIZEDMODEL_H
+
+#include <cstdint>
+#include <vector>
+#include "Int8Gemm.h"
+#include "Model.h"
+
+// Post-training int8 quantization of a trained Model, for inference only.
+// Weights are quantized symmetrically per output channel (a neuron of a dense layer, a filter of a
+// convolution); the activations between the layers per tensor, with scales calibrated as the largest
+// magnitude each layer's input reaches on a sample batch. The products run as int8 x int8 -> int32 (an
+// im2col + the same kernel for convolutions, max pooling directly on int8); turning the sums back into
+// Scalars, adding the bias, the activation and the quantization for the next layer are one pass per
+// sample. The last layer returns Scalar scores.
+// Activations are symmetric too, so ReLU and sigmoid outputs use 7 of the 8 bits.
+template<typename Scalar = double>
+class QuantizedModel {
+    using Matrix = MatrixT<Scalar>;
+    using Vector = VectorT<Scalar>;
+    using Int8Matrix = Eigen::Matrix<std::int8_t, Eigen::Dynamic, Eigen::Dynamic>;
+    using Int32Matrix = Eigen::Matrix<std::int32_t, Eigen::Dynamic, Eigen::Dynamic>;
+
+    enum class UnitType {
+        dense,
+        conv,
+        pool
+    };
+
+    struct Unit {
+        UnitType type;
+        Eigen::Index inputs = 0;
+        Eigen::Index outputs = 0;
+        // bytes between two samples of the unit's int8 input: padded to quantized::depth_step for a
+        // dense layer, which reads them as the b operand of its product
+        Eigen::Index input_stride = 0;
+        // scale of the unit's input: x = scale * q
+        Scalar input_scale = 1;
+
+        // dense: one column of depth bytes per neuron; conv: one per filter, (kh, kw, channels) flattened
+        Int8Matrix weights;
+        Eigen::Index depth = 0;
+        // per output element: input scale * the channel's weight scale, and the bias
+        Vector output_scales;
+        Vector biases;
+        activation activ_type = activation::relu;
+        precision activ_precision = precision::exact;
+
+        // conv: the input (height, width, channels) and the kernel (height, width)
+        TensorShape input_shape{};
+        std::array<Eigen::Index, 2> kernel{};
+        // pool: index into pool_layers
+        size_t pool = 0;
+    };
+
+    std::vector<Unit> units;
+    std::vector<MaxPool3D<Scalar>> pool_layers;
+    // softmax is monotonic, the argmax of the logits is that of the probabilities
+    bool skip_output_activation = false;
+    Eigen::Index chunk = 256;
+
+    // per-output-channel quantization of the columns of weights (depth = rows, padded); returns the scales
+    Vector quantize_weights(const Eigen::Ref<const Matrix> &weights, Int8Matrix &quantized) const;
+
+    // the largest magnitude reached by the input of every unit
+    std::vector<Scalar> calibrate(const Model<Scalar> &model, const Eigen::Ref<const Matrix> &calibration) const;
+
+    // turns the int32 sums of a unit into Scalars, adds the bias, activates and quantizes for the next
+    // unit with 1 / next_scale (or writes the Scalars to `scores` for the last unit), one sample at a time
+    void finish(const Unit &unit, const Int32Matrix &sums, Eigen::Index width, Vector &column, Int8Matrix *next,
+                Eigen::Index next_stride, Scalar next_scale, Eigen::Ref<Matrix> scores, bool last) const;
+
+    // unit u over `width` samples of `input`, into `output` (quantized for unit u + 1) or `scores`
+    void run_unit(size_t u, const Int8Matrix &input, Eigen::Index width, Int8Matrix &output,
+                  Eigen::Ref<Matrix> scores, Int32Matrix &sums, Int8Matrix &patches, Vector &column) const;
+
+public:
+    // Quantizes a trained model (its output layer included), calibrating the activation scales on the
+    // columns of `calibration`, a few hundred representative samples
+    QuantizedModel(const Model<Scalar> &model, const Eigen::Ref<const Matrix> &calibration);
+
+    // raw output scores of every sample (column): the logits for a softmax output layer
+    Matrix predict_scores(const Eigen::Ref<const Matrix> &data) const;
+
+    // index of the most probable class of every sample. Both predict methods are const and allocate
+    // their scratch memory per call, so any number of threads may share one model.
+    std::vector<int> predict_classes(const Eigen::Ref<const Matrix> &data) const;
+
+    // bytes taken by the quantized weights, for comparison with the Scalar ones
+    Eigen::Index weight_bytes() const;
+};
+
+
+#endif //DEEPDENDRO_QUANTIZEDMODEL_H
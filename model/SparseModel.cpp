@@ -0,0 +1,144 @@
+#include "SparseModel.h"
+#include <algorithm>
+#include <stdexcept>
+
+template<typename Scalar>
+SparseModel<Scalar>::SparseModel(const Model<Scalar> &model, const std::vector<weight_format> &formats)
+        : stages(model.getStages()), conv_layers(model.getConvLayers()), pool_layers(model.getPoolLayers()) {
+    const auto &dense_layers = model.getDenseLayers();
+    if (dense_layers.empty()) {
+        throw std::invalid_argument("SparseModel: the model has no dense layers");
+    }
+    if (!formats.empty() && formats.size() != dense_layers.size()) {
+        throw std::invalid_argument("SparseModel: " + std::to_string(formats.size()) + " formats for " +
+                                    std::to_string(dense_layers.size()) + " dense layers");
+    }
+
+    if (stages.empty()) {
+        inputs = dense_layers.front().getInputSize();
+    } else if (stages.front().first == CONVOLUTION) {
+        inputs = conv_layers[stages.front().second].getInputSize();
+    } else {
+        inputs = pool_layers[stages.front().second].getInputSize();
+    }
+    widest = inputs;
+    for (const auto &[type, index]: stages) {
+        const Eigen::Index outputs = type == CONVOLUTION ? conv_layers[index].getOutputSize()
+                                                         : pool_layers[index].getOutputSize();
+        widest = std::max(widest, outputs);
+    }
+    for (size_t k = 0; k < dense_layers.size(); ++k) {
+        const auto &layer = dense_layers[k];
+        const auto &weights = layer.getWeights();
+        DenseUnit unit;
+        unit.weights = SparseWeights<Scalar>(weights, formats.empty() ? SparseWeights<Scalar>::choose(weights)
+                                                                      : formats[k]);
+        unit.biases = layer.getBiases().transpose();
+        unit.activ_type = layer.getActivation();
+        unit.activ_precision = layer.getPrecision();
+        widest = std::max(widest, weights.rows());
+        dense_units.push_back(std::move(unit));
+    }
+    skip_output_activation = dense_layers.back().getActivation() == activation::softmax;
+}
+
+template<typename Scalar>
+MatrixT<Scalar> SparseModel<Scalar>::predict_scores(const Eigen::Ref<const Matrix> &data) const {
+    if (data.rows() != inputs) {
+        throw std::invalid_argument("SparseModel::predict_scores: the data has " + std::to_string(data.rows()) +
+                                    " rows, the model takes " + std::to_string(inputs));
+    }
+    const Eigen::Index outputs = dense_units.back().weights.rows();
+    Matrix scores(outputs, data.cols());
+    // stages ping-pong between ping and pong (features x samples), the dense layers between their
+    // transposes
+    Matrix ping(stages.empty() ? 0 : widest, chunk), pong(stages.empty() ? 0 : widest, chunk);
+    Matrix ping_t(chunk, widest), pong_t(chunk, widest);
+
+    for (Eigen::Index start = 0; start < data.cols(); start += chunk) {
+        const Eigen::Index width = std::min(chunk, data.cols() - start);
+        Matrix *in = &ping;
+        Matrix *out = &pong;
+        bool from_data = true;
+        auto input = [&](const Eigen::Index rows) -> Eigen::Ref<const Matrix> {
+            if (from_data) {
+                return data.middleCols(start, width);
+            }
+            return in->topLeftCorner(rows, width);
+        };
+        Eigen::Index features = inputs;
+        for (const auto &[type, index]: stages) {
+            if (type == CONVOLUTION) {
+                const auto &conv = conv_layers[index];
+                features = conv.getOutputSize();
+                conv.infer(input(conv.getInputSize()), out->topLeftCorner(features, width));
+            } else {
+                const auto &pool = pool_layers[index];
+                features = pool.getOutputSize();
+                pool.infer(input(pool.getInputSize()), out->topLeftCorner(features, width));
+            }
+            from_data = false;
+            std::swap(in, out);
+        }
+
+        Matrix *in_t = &ping_t;
+        Matrix *out_t = &pong_t;
+        in_t->topLeftCorner(width, features) = input(features).transpose();
+        for (size_t k = 0; k < dense_units.size(); ++k) {
+            const DenseUnit &unit = dense_units[k];
+            const Eigen::Index neurons = unit.weights.rows();
+            auto y = out_t->topLeftCorner(width, neurons);
+            y.rowwise() = unit.biases;
+            unit.weights.multiply_add(in_t->topLeftCorner(width, features), y);
+            if (k + 1 < dense_units.size() || !skip_output_activation) {
+                // activate works on columns, which softmax normalizes: a sample has to be one
+                act::dispatch(unit.activ_type, unit.activ_precision, [&](auto policy) {
+                    if (unit.activ_type == activation::softmax) {
+                        Matrix sample_major = y.transpose();
+                        act::activate<decltype(policy)>(sample_major);
+                        y = sample_major.transpose();
+                    } else {
+                        act::activate<decltype(policy)>(y);
+                    }
+                });
+            }
+            features = neurons;
+            std::swap(in_t, out_t);
+        }
+        scores.middleCols(start, width) = in_t->topLeftCorner(width, outputs).transpose();
+    }
+    return scores;
+}
+
+template<typename Scalar>
+std::vector<int> SparseModel<Scalar>::predict_classes(const Eigen::Ref<const Matrix> &data) const {
+    const Matrix scores = predict_scores(data);
+    std::vector<int> classes(scores.cols());
+    Eigen::Index best;
+    for (Eigen::Index i = 0; i < scores.cols(); ++i) {
+        scores.col(i).maxCoeff(&best);
+        classes[i] = static_cast<int>(best);
+    }
+    return classes;
+}
+
+template<typename Scalar>
+std::vector<weight_format> SparseModel<Scalar>::getFormats() const {
+    std::vector<weight_format> formats;
+    for (const auto &unit: dense_units) {
+        formats.push_back(unit.weights.format());
+    }
+    return formats;
+}
+
+template<typename Scalar>
+Eigen::Index SparseModel<Scalar>::weight_bytes() const {
+    Eigen::Index bytes = 0;
+    for (const auto &unit: dense_units) {
+        bytes += unit.weights.bytes();
+    }
+    return bytes;
+}
+
+template class SparseModel<float>;
+template class SparseModel<double>;
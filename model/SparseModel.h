@@ -0,0 +1,55 @@
+#ifndef DEEPDENDRO_SPARSEMODEL_H
+#define DEEPDENDRO_SPARSEMODEL_H
+
+#include <vector>
+#include "Model.h"
+#include "SparseWeights.h"
+
+// Inference form of a trained, typically pruned (see PruningConfig) Model. Every dense layer keeps
+// its weights dense, in CSR or in blocks, whichever SparseWeights::choose expects to be fastest for
+// the sparsity the layer reached, unless the caller picks the formats. The convolutional stages run
+// as in Model; their output is transposed once per chunk, the dense layers then work on samples x
+// features activations (see SparseWeights).
+template<typename Scalar = double>
+class SparseModel {
+    using Matrix = MatrixT<Scalar>;
+    using Vector = VectorT<Scalar>;
+
+    struct DenseUnit {
+        SparseWeights<Scalar> weights;
+        Eigen::Matrix<Scalar, 1, Eigen::Dynamic> biases;
+        activation activ_type = activation::relu;
+        precision activ_precision = precision::exact;
+    };
+
+    std::vector<std::pair<StageType, size_t>> stages;
+    std::vector<Convolutional3D<Scalar>> conv_layers;
+    std::vector<MaxPool3D<Scalar>> pool_layers;
+    std::vector<DenseUnit> dense_units;
+    Eigen::Index inputs = 0;
+    Eigen::Index widest = 0;
+    // softmax is monotonic, the argmax of the logits is that of the probabilities
+    bool skip_output_activation = false;
+    Eigen::Index chunk = 256;
+
+public:
+    // Copies the weights of a trained model (its output layer included). `formats` has one entry per
+    // dense layer; left empty, every layer gets SparseWeights::choose of its weights.
+    explicit SparseModel(const Model<Scalar> &model, const std::vector<weight_format> &formats = {});
+
+    // raw output scores of every sample (column): the logits for a softmax output layer
+    Matrix predict_scores(const Eigen::Ref<const Matrix> &data) const;
+
+    // index of the most probable class of every sample. Both predict methods are const and allocate
+    // their scratch memory per call, so any number of threads may share one model.
+    std::vector<int> predict_classes(const Eigen::Ref<const Matrix> &data) const;
+
+    // the format every dense layer ended up with
+    std::vector<weight_format> getFormats() const;
+
+    // bytes taken by the dense layers' weights and sparse indices
+    Eigen::Index weight_bytes() const;
+};
+
+
+#endif //DEEPDENDRO_SPARSEMODEL_H
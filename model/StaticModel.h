@@ -0,0 +1,174 @@
+#ifndef DEEPDENDRO_STATICMODEL_H
+#define DEEPDENDRO_STATICMODEL_H
+
+#include <cmath>
+#include <stdexcept>
+#include <tuple>
+#include "Model.h"
+
+// A dense layer of a StaticModel: In inputs, Out neurons, the activation one of the act:: policies.
+template<int In, int Out, typename Activation, typename Scalar = double>
+struct Dense {
+    static_assert(In > 0 && Out > 0, "a dense layer needs at least one input and one neuron");
+
+    static constexpr int inputs = In;
+    static constexpr int outputs = Out;
+    using activation_type = Activation;
+    using scalar_type = Scalar;
+
+    // row vectors have to be row-major in Eigen
+    using Weights = Eigen::Matrix<Scalar, Out, In, Out == 1 && In != 1 ? Eigen::RowMajor : Eigen::ColMajor>;
+    using Column = Eigen::Matrix<Scalar, Out, 1>;
+
+    // weights, then biases; padded so that the next layer starts aligned
+    static constexpr Eigen::Index parameters = (Out * In + Out + 15) / 16 * 16;
+};
+
+// Network whose layer sizes and activations are template arguments, e.g.
+//     StaticModel<Dense<784, 32, act::Relu>, Dense<32, 10, act::Softmax>>
+// Every kernel works on fixed-size Eigen types, so the compiler sees the sizes and inlines the
+// activations: this is the per-sample latency path, with no dispatch and no heap allocation per call.
+// The parameters of all layers live in one heap block and are seen through fixed-size maps,
+// since fixed-size matrices of this size would not fit on the stack.
+template<typename... Layers>
+class StaticModel {
+    static_assert(sizeof...(Layers) > 0, "a StaticModel needs at least one layer");
+
+    template<size_t I>
+    using LayerAt = std::tuple_element_t<I, std::tuple<Layers...>>;
+
+    static constexpr size_t n_layers = sizeof...(Layers);
+
+public:
+    using Scalar = typename LayerAt<0>::scalar_type;
+    static constexpr int input_size = LayerAt<0>::inputs;
+    static constexpr int output_size = LayerAt<n_layers - 1>::outputs;
+    using Input = Eigen::Matrix<Scalar, input_size, 1>;
+    using Output = Eigen::Matrix<Scalar, output_size, 1>;
+
+private:
+    static constexpr bool chained() {
+        constexpr int outputs[] = {Layers::outputs...};
+        constexpr int inputs[] = {Layers::inputs...};
+        for (size_t i = 1; i < n_layers; i++) {
+            if (outputs[i - 1] != inputs[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static_assert(chained(), "every layer must take as many inputs as the previous one has neurons");
+    static_assert((std::is_same_v<typename Layers::scalar_type, Scalar> && ...),
+                  "all layers of a StaticModel must use the same scalar type");
+
+    // offset of every layer's parameters in `parameters`, the total at the end
+    static constexpr std::array<Eigen::Index, n_layers + 1> offsets = [] {
+        std::array<Eigen::Index, n_layers + 1> result{};
+        constexpr Eigen::Index sizes[] = {Layers::parameters...};
+        for (size_t i = 0; i < n_layers; i++) {
+            result[i + 1] = result[i] + sizes[i];
+        }
+        return result;
+    }();
+
+    // aligned by Eigen's allocator, and every layer's block starts at a multiple of 16 scalars
+    VectorT<Scalar> parameters;
+
+    template<size_t I, typename Column>
+    Output forward_from(const Column &x) const {
+        using L = LayerAt<I>;
+        typename L::Column z = biases<I>();
+        z.noalias() += weights<I>() * x;
+        act::activate<typename L::activation_type>(z);
+        if constexpr (I + 1 == n_layers) {
+            return z;
+        } else {
+            return forward_from<I + 1>(z);
+        }
+    }
+
+    template<size_t... I>
+    void load_layers(const std::vector<HiddenLayer<Scalar>> &layers, std::index_sequence<I...>) {
+        ((weights<I>() = layers[I].getWeights(), biases<I>() = layers[I].getBiases()), ...);
+    }
+
+public:
+    // weights initialized like HiddenLayer's (scaled for ReLU), biases at zero
+    StaticModel() : parameters(VectorT<Scalar>::Zero(offsets.back())) {
+        init_layers(std::make_index_sequence<n_layers>{});
+    }
+
+    template<size_t I>
+    Eigen::Map<typename LayerAt<I>::Weights, Eigen::AlignedMax> weights() {
+        return Eigen::Map<typename LayerAt<I>::Weights, Eigen::AlignedMax>(parameters.data() + offsets[I]);
+    }
+
+    template<size_t I>
+    Eigen::Map<const typename LayerAt<I>::Weights, Eigen::AlignedMax> weights() const {
+        return Eigen::Map<const typename LayerAt<I>::Weights, Eigen::AlignedMax>(parameters.data() + offsets[I]);
+    }
+
+    template<size_t I>
+    Eigen::Map<typename LayerAt<I>::Column> biases() {
+        return Eigen::Map<typename LayerAt<I>::Column>(parameters.data() + offsets[I] + LayerAt<I>::inputs * LayerAt<I>::outputs);
+    }
+
+    template<size_t I>
+    Eigen::Map<const typename LayerAt<I>::Column> biases() const {
+        return Eigen::Map<const typename LayerAt<I>::Column>(
+                parameters.data() + offsets[I] + LayerAt<I>::inputs * LayerAt<I>::outputs);
+    }
+
+    // Copies the parameters of a trained dense-only Model. Its layers, the output layer added by
+    // train() included, must match the template arguments in number, sizes and activations.
+    void load(const Model<Scalar> &model) {
+        const auto &layers = model.getDenseLayers();
+        if (model.getStageCount() != 0) {
+            throw std::invalid_argument("StaticModel can only load a model of dense layers");
+        }
+        if (layers.size() != n_layers) {
+            throw std::invalid_argument("StaticModel: the model has " + std::to_string(layers.size()) +
+                                        " dense layers, expected " + std::to_string(n_layers));
+        }
+        constexpr int inputs[] = {Layers::inputs...};
+        constexpr int outputs[] = {Layers::outputs...};
+        constexpr activation types[] = {Layers::activation_type::type...};
+        for (size_t i = 0; i < n_layers; i++) {
+            const auto &weights = layers[i].getWeights();
+            if (weights.rows() != outputs[i] || weights.cols() != inputs[i] ||
+                layers[i].getActivation() != types[i]) {
+                throw std::invalid_argument("StaticModel: layer " + std::to_string(i) +
+                                            " differs in shape or activation from the model's");
+            }
+        }
+        load_layers(layers, std::make_index_sequence<n_layers>{});
+    }
+
+    // activations of the output layer for one sample; `sample` is any column with contiguous
+    // coefficients (a column of a data set, a VectorXd, an Input)
+    template<typename Derived>
+    Output predict(const Eigen::DenseBase<Derived> &sample) const {
+        static_assert(Derived::ColsAtCompileTime == 1 && Derived::InnerStrideAtCompileTime == 1,
+                      "predict takes one contiguous column");
+        eigen_assert(sample.size() == input_size);
+        return forward_from<0>(Eigen::Map<const Input>(sample.derived().data()));
+    }
+
+    template<typename Derived>
+    int predict_class(const Eigen::DenseBase<Derived> &sample) const {
+        Eigen::Index best;
+        predict(sample).maxCoeff(&best);
+        return static_cast<int>(best);
+    }
+
+private:
+    template<size_t... I>
+    void init_layers(std::index_sequence<I...>) {
+        ((weights<I>() = LayerAt<I>::Weights::Random() *
+                         static_cast<Scalar>(std::sqrt(2. / LayerAt<I>::inputs))), ...);
+    }
+};
+
+
+#endif //DEEPDENDRO_STATICMODEL_H
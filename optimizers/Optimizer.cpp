@@ -0,0 +1,92 @@
+#include "Optimizer.h"
+#include <algorithm>
+#include <cmath>
+
+template<typename Scalar>
+void Optimizer<Scalar>::init_slot(OptimizerSlot<Scalar> &slot, const Eigen::Index size) const {
+    slot.first.setZero(has_first() ? size : 0);
+    slot.second.setZero(has_second() ? size : 0);
+}
+
+template<typename Scalar>
+void Optimizer<Scalar>::prepare_slot(OptimizerSlot<Scalar> &slot, const Eigen::Index size) const {
+    if (slot.first.size() != (has_first() ? size : 0) || slot.second.size() != (has_second() ? size : 0)) {
+        init_slot(slot, size);
+    }
+}
+
+template<typename Scalar>
+void Optimizer<Scalar>::update(Scalar *param, const Scalar *grad, const Eigen::Index size,
+                               OptimizerSlot<Scalar> &slot, const double learning_rate, const bool decay) const {
+    prepare_slot(slot, size);
+    update_range(param, grad, slot, learning_rate, decay, 0, size);
+}
+
+template<typename Scalar>
+void Optimizer<Scalar>::update_range(Scalar *param, const Scalar *grad, OptimizerSlot<Scalar> &slot,
+                                     const double learning_rate, const bool decay, const Eigen::Index begin,
+                                     const Eigen::Index end) const {
+    using Array = Eigen::Array<Scalar, Eigen::Dynamic, 1>;
+    const auto lr = static_cast<Scalar>(learning_rate);
+    const auto wd = static_cast<Scalar>(decay ? config.weight_decay : 0);
+    const auto eps = static_cast<Scalar>(config.epsilon);
+
+    // Adam's bias corrections, folded into the step size and epsilon
+    Scalar adam_step = lr, adam_eps = eps;
+    if (config.type == optimizer::adam || config.type == optimizer::adamw) {
+        const double c1 = 1 - std::pow(config.beta1, static_cast<double>(t));
+        const double c2 = 1 - std::pow(config.beta2, static_cast<double>(t));
+        adam_step = static_cast<Scalar>(learning_rate * std::sqrt(c2) / c1);
+        adam_eps = static_cast<Scalar>(config.epsilon * std::sqrt(c2));
+    }
+    const auto mu = static_cast<Scalar>(config.momentum);
+    const auto b1 = static_cast<Scalar>(config.beta1), b2 = static_cast<Scalar>(config.beta2);
+    const auto rho = static_cast<Scalar>(config.rho);
+    const Scalar one(1);
+
+    for (Eigen::Index start = begin; start < end; start += update_block) {
+        const Eigen::Index len = std::min(update_block, end - start);
+        Eigen::Map<Array> p(param + start, len);
+        const Eigen::Map<const Array> raw_g(grad + start, len);
+        // L2 weight decay, except for adamw where it is decoupled
+        const auto g = raw_g + (config.type == optimizer::adamw ? Scalar(0) : wd) * p;
+
+        switch (config.type) {
+            case optimizer::sgd:
+                if (mu == 0) {
+                    p -= lr * g;
+                } else {
+                    auto v = slot.first.segment(start, len);
+                    v = mu * v + g;
+                    if (config.nesterov) {
+                        p -= lr * (g + mu * v);
+                    } else {
+                        p -= lr * v;
+                    }
+                }
+                break;
+            case optimizer::adam:
+            case optimizer::adamw: {
+                auto m = slot.first.segment(start, len);
+                auto v = slot.second.segment(start, len);
+                m = b1 * m + (one - b1) * g;
+                v = b2 * v + (one - b2) * g.square();
+                if (config.type == optimizer::adamw) {
+                    p = p * (one - lr * wd) - adam_step * m / (v.sqrt() + adam_eps);
+                } else {
+                    p -= adam_step * m / (v.sqrt() + adam_eps);
+                }
+                break;
+            }
+            case optimizer::rmsprop: {
+                auto v = slot.second.segment(start, len);
+                v = rho * v + (one - rho) * g.square();
+                p -= lr * g / (v.sqrt() + eps);
+                break;
+            }
+        }
+    }
+}
+
+template class Optimizer<float>;
+template class Optimizer<double>;
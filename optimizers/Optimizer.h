@@ -0,0 +1,113 @@
+#ifndef DEEPDENDRO_OPTIMIZER_H
+#define DEEPDENDRO_OPTIMIZER_H
+
+#include <Eigen/Dense>
+
+enum optimizer {
+    sgd,
+    adam,
+    adamw,
+    rmsprop
+};
+
+// everything but the learning rate, which stays an argument of train()
+struct OptimizerConfig {
+    optimizer type = optimizer::sgd;
+    // sgd: heavy-ball momentum (0 disables it), optionally in the Nesterov form
+    double momentum = 0;
+    bool nesterov = false;
+    // adam / adamw
+    double beta1 = 0.9;
+    double beta2 = 0.999;
+    // rmsprop: decay of the squared-gradient average
+    double rho = 0.9;
+    double epsilon = 1e-8;
+    // L2 penalty added to the gradient; adamw applies it decoupled, straight to the parameter.
+    // Only weights are decayed, biases never are.
+    double weight_decay = 0;
+};
+
+// optimizer state of one parameter tensor: velocity / first moment and second moment
+template<typename Scalar>
+struct OptimizerSlot {
+    Eigen::Array<Scalar, Eigen::Dynamic, 1> first;
+    Eigen::Array<Scalar, Eigen::Dynamic, 1> second;
+};
+
+// The update kernels walk the parameter, its gradient and its state together in cache-sized blocks,
+// so every element is read and written once per step, however many state terms the rule has.
+// They work on raw buffers, which makes them shared by Matrix (dense) and Tensor (conv) parameters.
+template<typename Scalar>
+class Optimizer {
+    OptimizerConfig config;
+    // number of steps taken, for Adam's bias correction
+    size_t t = 0;
+
+    // velocity (sgd with momentum) or first moment (adam)
+    bool has_first() const {
+        return config.type == optimizer::adam || config.type == optimizer::adamw ||
+               (config.type == optimizer::sgd && config.momentum != 0);
+    }
+
+    bool has_second() const {
+        return config.type != optimizer::sgd;
+    }
+
+public:
+    // update_range walks its range in blocks of this many elements: parameter, gradient and two state
+    // blocks stay well inside L1
+    static constexpr Eigen::Index update_block = 512;
+
+    Optimizer() = default;
+
+    explicit Optimizer(const OptimizerConfig &config) : config(config) {}
+
+    const OptimizerConfig &getConfig() const {
+        return config;
+    }
+
+    // plain SGD needs neither state nor a materialized gradient,
+    // so layers may accumulate the gradient product straight into the parameter
+    bool is_plain_sgd() const {
+        return config.type == optimizer::sgd && config.momentum == 0 && config.weight_decay == 0;
+    }
+
+    // sizes the state of a parameter with `size` elements, so that update() does not allocate
+    void init_slot(OptimizerSlot<Scalar> &slot, Eigen::Index size) const;
+
+    // to be called once per training step, before the updates of that step
+    void begin_step() {
+        ++t;
+    }
+
+    // sizes the slot unless it already fits a parameter of `size` elements
+    void prepare_slot(OptimizerSlot<Scalar> &slot, Eigen::Index size) const;
+
+    // param -= update(grad, state), in one pass; `decay` enables weight decay for this parameter
+    void update(Scalar *param, const Scalar *grad, Eigen::Index size, OptimizerSlot<Scalar> &slot,
+                double learning_rate, bool decay) const;
+
+    // the same for elements [begin, end) only, with a prepared slot: disjoint ranges of one parameter
+    // may be updated by different threads. A range starting at a multiple of update_block is updated
+    // bit for bit as in a whole-parameter update.
+    void update_range(Scalar *param, const Scalar *grad, OptimizerSlot<Scalar> &slot, double learning_rate,
+                      bool decay, Eigen::Index begin, Eigen::Index end) const;
+};
+
+// One parameter tensor of a layer as raw memory, with what updating it takes. A model training on
+// several replicas (DataParallelConfig) copies the values out, sums the gradients in and updates
+// slices of every parameter from different threads.
+template<typename Scalar>
+struct ParameterBlock {
+    Scalar *values;
+    Scalar *gradient;
+    Eigen::Index size;
+    const Optimizer<Scalar> *optimizer;
+    OptimizerSlot<Scalar> *slot;
+    bool decay;
+    // 0 for the weights removed by pruning, which stay zero after the update; null without pruning
+    const Scalar *mask;
+};
+
+
+#endif //DEEPDENDRO_OPTIMIZER_H
@@ -0,0 +1,145 @@
+#ifndef DEEPDENDRO_DATA_PARALLEL_H
+#define DEEPDENDRO_DATA_PARALLEL_H
+
+#include <barrier>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "execution_context.h"
+
+// Data-parallel training of one model (Model::setDataParallel). Every batch is cut into `shards`
+// column ranges, each trained forward and backward by its own replica of the layers; the replicas'
+// gradients are then summed, weighted by their share of the batch, and one update is applied. Both the
+// sum and the update are split across the workers by parameter ranges, so no thread reduces or updates
+// the whole model.
+// A shard's gradient does not depend on the thread that computes it and the sum always runs over the
+// shards in the same order, so training is deterministic for a given number of shards. By default there
+// is one shard per worker; a fixed `shards` makes the results identical for any number of workers.
+//
+// `asynchronous` trains Hogwild-style instead: every worker pulls whole batches, computes their gradient
+// on its own replica from a copy of the current parameters and adds its update to the model's parameters,
+// with no lock and no barrier between steps. The copy and the adds are relaxed atomic operations: a copy
+// may mix values from before and after other workers' updates, but no update is lost, and no worker ever
+// waits. Every worker keeps its own optimizer state (momentum, Adam moments) and `shards` is ignored.
+// Pruning happens between epochs.
+struct DataParallelConfig {
+    // threads training the shards, the calling one included; 1 disables data parallelism, 0 runs one
+    // worker per thread of the budget (execution::set_threads)
+    size_t workers = 1;
+    // 0: one per worker; more shards than workers are dealt round-robin
+    size_t shards = 0;
+    bool asynchronous = false;
+
+    size_t worker_count() const {
+        return workers != 0 ? workers : execution::threads();
+    }
+};
+
+// What one worker did in one epoch of data-parallel training (Model::getWorkerStats)
+struct WorkerStats {
+    size_t epoch = 0;
+    size_t worker = 0;
+    // batches (asynchronous) or shards (synchronous) trained
+    size_t steps = 0;
+    double samples = 0;
+    // time spent working, the waits for the other workers excluded
+    double seconds = 0;
+    // summed over the samples
+    double loss = 0;
+    double correct = 0;
+
+    // samples per second
+    double throughput() const {
+        return seconds > 0 ? samples / seconds : 0;
+    }
+
+    double mean_loss() const {
+        return samples > 0 ? loss / samples : 0;
+    }
+
+    double accuracy() const {
+        return samples > 0 ? correct / samples : 0;
+    }
+};
+
+// A fixed team of threads running one job at a time on all of them: run(job) calls job(w) for every
+// worker w, the calling thread being worker 0, and returns once every call has returned. The threads
+// wait on a barrier between jobs, so a job costs no thread creation. The workers already share the
+// thread budget, so each of them runs its products and tensor expressions alone (execution::SerialScope).
+class WorkerTeam {
+    std::function<void(size_t)> job;
+    std::barrier<> start;
+    std::barrier<> done;
+    bool stopping = false;
+    std::vector<std::exception_ptr> errors;
+    std::vector<std::thread> threads;
+
+    void call(const size_t worker) {
+        try {
+            job(worker);
+        } catch (...) {
+            errors[worker] = std::current_exception();
+        }
+    }
+
+public:
+    explicit WorkerTeam(const size_t workers)
+            : start(static_cast<std::ptrdiff_t>(workers)), done(static_cast<std::ptrdiff_t>(workers)),
+              errors(workers) {
+        for (size_t w = 1; w < workers; ++w) {
+            threads.emplace_back([this, w] {
+                execution::SerialScope serial;
+                while (true) {
+                    start.arrive_and_wait();
+                    if (stopping) {
+                        return;
+                    }
+                    call(w);
+                    done.arrive_and_wait();
+                }
+            });
+        }
+    }
+
+    WorkerTeam(const WorkerTeam &) = delete;
+
+    WorkerTeam &operator=(const WorkerTeam &) = delete;
+
+    ~WorkerTeam() {
+        stopping = true;
+        start.arrive_and_wait();
+        for (auto &thread: threads) {
+            thread.join();
+        }
+    }
+
+    size_t size() const {
+        return errors.size();
+    }
+
+    // the first exception thrown by a worker is rethrown here, after all of them finished
+    void run(std::function<void(size_t)> task) {
+        job = std::move(task);
+        start.arrive_and_wait();
+        {
+            execution::SerialScope serial;
+            call(0);
+        }
+        done.arrive_and_wait();
+        for (auto &error: errors) {
+            if (error) {
+                std::exception_ptr first = std::exchange(error, nullptr);
+                for (auto &other: errors) {
+                    other = nullptr;
+                }
+                std::rethrow_exception(first);
+            }
+        }
+    }
+};
+
+
+#endif //DEEPDENDRO_DATA_PARALLEL_H
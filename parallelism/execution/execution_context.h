@@ -0,0 +1,89 @@
+#ifndef DEEPDENDRO_EXECUTION_CONTEXT_H
+#define DEEPDENDRO_EXECUTION_CONTEXT_H
+
+#ifndef EIGEN_USE_THREADS
+#define EIGEN_USE_THREADS
+#endif
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <Eigen/Dense>
+#include <unsupported/Eigen/CXX11/Tensor>
+
+// The library's thread budget. One knob, execution::set_threads, sets how many cores the work of a
+// model may use:
+// - every Eigen::Tensor expression of the convolutional layers (convolve, reverse, pad, slice, reshape)
+//   is evaluated on execution::device(), a ThreadPoolDevice over a pool of that many threads;
+// - Eigen's matrix products, GemmWorkspace included, are split into that many parts (Eigen::setNbThreads;
+//   Eigen parallelizes products through OpenMP, which the build enables when it is available);
+// - data-parallel training (DataParallelConfig::workers == 0) runs that many workers.
+// The default is 1, everything on the calling thread. set_threads must not be called while a model
+// is training or predicting.
+// Threads that already are one of several working in parallel (the workers of data-parallel training)
+// declare themselves with SerialScope: their products and tensor expressions stay on them, instead of
+// every worker asking the whole budget for more threads.
+namespace execution {
+    namespace detail {
+        struct Context {
+            size_t threads = 1;
+            std::unique_ptr<Eigen::ThreadPool> pool;
+            std::unique_ptr<Eigen::ThreadPoolDevice> device;
+            // the same pool, restricted to the calling thread (a device with one core runs inline)
+            std::unique_ptr<Eigen::ThreadPoolDevice> serial_device;
+
+            explicit Context(const size_t n) : threads(std::max<size_t>(n, 1)) {
+                pool = std::make_unique<Eigen::ThreadPool>(static_cast<int>(threads));
+                device = std::make_unique<Eigen::ThreadPoolDevice>(pool.get(), static_cast<int>(threads));
+                serial_device = std::make_unique<Eigen::ThreadPoolDevice>(pool.get(), 1);
+            }
+        };
+
+        inline std::unique_ptr<Context> &context() {
+            static std::unique_ptr<Context> instance = std::make_unique<Context>(1);
+            return instance;
+        }
+
+        inline thread_local bool serial = false;
+    }
+
+    inline void set_threads(const size_t n) {
+        detail::context() = std::make_unique<detail::Context>(n);
+        Eigen::setNbThreads(static_cast<int>(detail::context()->threads));
+    }
+
+    inline size_t threads() {
+        return detail::context()->threads;
+    }
+
+    // whether the calling thread may spread its work over the budget (see SerialScope)
+    inline bool parallel_allowed() {
+        return !detail::serial && detail::context()->threads > 1;
+    }
+
+    // the device tensor expressions are evaluated on: the pool, or the calling thread in a SerialScope
+    inline const Eigen::ThreadPoolDevice &device() {
+        const auto &context = detail::context();
+        return detail::serial ? *context->serial_device : *context->device;
+    }
+
+    // for its lifetime, the calling thread does its products and tensor expressions alone
+    class SerialScope {
+        bool previous;
+    public:
+        SerialScope() : previous(detail::serial) {
+            detail::serial = true;
+        }
+
+        SerialScope(const SerialScope &) = delete;
+
+        SerialScope &operator=(const SerialScope &) = delete;
+
+        ~SerialScope() {
+            detail::serial = previous;
+        }
+    };
+}
+
+
+#endif //DEEPDENDRO_EXECUTION_CONTEXT_H
@@ -3,34 +3,123 @@
 //
 
 #include "inter_model.h"
+#include <chrono>
+#include <stdexcept>
 
 
-void InterModel::addModel(const Model& mdl, size_t epochs, double learning_rate) {
-    ts_queue.push(ModelObject {mdl, epochs, learning_rate});
+template<typename Scalar>
+InterModel<Scalar>::~InterModel() {
+    wait();
 }
 
-void InterModel::runThreads(int num_threads) {
-    ts_queue.push(ModelObject {}); // poison pill
+template<typename Scalar>
+std::future<TrainedModel<Scalar>>
+InterModel<Scalar>::addModel(Model<Scalar> mdl, size_t epochs, double learning_rate, size_t batch_size) {
+    std::promise<TrainedModel<Scalar>> result;
+    std::future<TrainedModel<Scalar>> trained = result.get_future();
+    pending.push_back(ModelObject<Scalar> {std::move(mdl), epochs, learning_rate, batch_size, std::move(result)});
+    return trained;
+}
 
+template<typename Scalar>
+void InterModel<Scalar>::runThreads(int num_threads) {
+    wait();
+    if (num_threads <= 0) {
+        return;
+    }
+    // the threads start on the first jobs while the rest are still being queued; a few jobs per thread
+    // in the queue keep them busy
+    MPMCQueue<ModelObject<Scalar>> jobs(2 * static_cast<size_t>(num_threads));
     for(int i = 0; i < num_threads; ++i){
-        threads.emplace_back(trainModels, std::ref(ts_queue));
+        threads.emplace_back(trainModels, std::ref(jobs));
     }
+    for (auto &job: pending) {
+        jobs.emplace(std::move(job));
+    }
+    pending.clear();
+    jobs.close();
+    wait();
+}
 
-    for(int i = 0; i < num_threads; ++i){
-        threads[i].join();
+template<typename Scalar>
+void InterModel<Scalar>::trainModels(MPMCQueue<ModelObject<Scalar>> &jobs) {
+    ModelObject<Scalar> mdl;
+    while (jobs.pop(mdl)) {
+        try {
+            const auto began = std::chrono::steady_clock::now();
+            mdl.obj.train(mdl.epoch, mdl.learning_rate, true, mdl.batch_size);
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+            const double loss = mdl.obj.getDenseLayers().back().getLoss();
+            mdl.result.set_value({std::move(mdl.obj), mdl.learning_rate, mdl.epoch, false, loss, -1, seconds});
+        } catch (...) {
+            mdl.result.set_exception(std::current_exception());
+        }
     }
 }
 
-void InterModel::trainModels(TSQueue<ModelObject> &ts_queue) {
-    while (true) {
-        ModelObject mdl = ts_queue.pop();
+template<typename Scalar>
+void InterModel<Scalar>::runSweep(int num_threads, std::shared_ptr<const Matrix> validation_data,
+                                  std::shared_ptr<const Matrix> validation_labels, const SweepOptions &options) {
+    if (!validation_data || !validation_labels) {
+        throw std::invalid_argument("InterModel::runSweep: no validation set");
+    }
+    wait();
+    this->validation_data = std::move(validation_data);
+    this->validation_labels = std::move(validation_labels);
+
+    sweep_jobs = std::move(pending);
+    pending.clear();
+    std::vector<size_t> epochs;
+    std::vector<double> costs;
+    for (const auto &job: sweep_jobs) {
+        epochs.push_back(job.epoch);
+        costs.push_back(job.obj.epochCost() * static_cast<double>(job.epoch));
+    }
+    scheduler = std::make_unique<SweepScheduler>(std::move(epochs), costs, options);
+
+    for (int i = 0; i < num_threads; ++i) {
+        threads.emplace_back(&InterModel::sweepWorker, this);
+    }
+}
 
-        if (mdl.isEmpty()) {
-            ts_queue.push(mdl);
-            return;
+template<typename Scalar>
+void InterModel<Scalar>::sweepWorker() {
+    SweepScheduler::Task task{};
+    while (scheduler->next(task)) {
+        ModelObject<Scalar> &job = sweep_jobs[task.config];
+        const double loss = job.epochs_trained != 0 ? job.obj.getDenseLayers().back().getLoss() : 0;
+        if (task.epochs == 0) {
+            job.result.set_value({std::move(job.obj), job.learning_rate, job.epochs_trained, true, loss,
+                                  job.accuracy, job.seconds});
+            continue;
         }
+        try {
+            const auto began = std::chrono::steady_clock::now();
+            // a later train() call continues the training, optimizer state included
+            job.obj.train(task.epochs, job.learning_rate, false, job.batch_size);
+            job.accuracy = job.obj.evaluate(*validation_data, *validation_labels).accuracy();
+            job.epochs_trained += task.epochs;
+            job.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+        } catch (...) {
+            scheduler->abandon(task);
+            job.result.set_exception(std::current_exception());
+            continue;
+        }
+        if (scheduler->report(task, job.accuracy)) {
+            const double final_loss = job.obj.getDenseLayers().back().getLoss();
+            job.result.set_value({std::move(job.obj), job.learning_rate, job.epochs_trained, false, final_loss,
+                                  job.accuracy, job.seconds});
+        }
+    }
+}
 
-        mdl.obj.train(mdl.epoch, mdl.learning_rate);
+template<typename Scalar>
+void InterModel<Scalar>::wait() {
+    for (auto &thread: threads) {
+        thread.join();
     }
+    threads.clear();
 }
 
+template class InterModel<float>;
+template class InterModel<double>;
@@ -5,28 +5,87 @@
 #ifndef DEEPDENDRO_INTER_MODEL_H
 #define DEEPDENDRO_INTER_MODEL_H
 
-#include "ts_queue.h"
+#include <future>
+#include <memory>
+#include "mpmc_queue.h"
+#include "sweep_scheduler.h"
 #include "Model.h"
 
+// A model once InterModel is done with it
+template<typename Scalar = double>
+struct TrainedModel {
+    Model<Scalar> model;
+    double learning_rate;
+    // epochs trained, fewer than asked if successive halving stopped the model early
+    size_t epochs;
+    bool stopped_early;
+    // of the last training step
+    double loss;
+    // on the validation set of the sweep after the last epoch; -1 outside a sweep
+    double accuracy;
+    // spent training, the evaluations of a sweep included
+    double seconds;
+};
+
+// One training job. The model references its training set (Model::addInput), so a job costs the
+// model's layers, never a copy of the data: jobs built from one dataset all share it.
+template<typename Scalar = double>
 struct ModelObject {
-    Model obj;
+    Model<Scalar> obj;
     size_t epoch;
     double learning_rate;
-    bool isEmpty() {return (epoch==0);};
+    // 0: full batch
+    size_t batch_size;
+    std::promise<TrainedModel<Scalar>> result;
+    // progress in a sweep
+    size_t epochs_trained = 0;
+    double accuracy = -1;
+    double seconds = 0;
 };
 
+template<typename Scalar = double>
 class InterModel {
-    TSQueue<ModelObject> ts_queue;
+    using Matrix = MatrixT<Scalar>;
+
+    // added, not yet handed to the threads
+    std::vector<ModelObject<Scalar>> pending;
     std::vector<std::thread> threads;
 
+    // the sweep in progress: its jobs, indexed like the scheduler's configurations
+    std::vector<ModelObject<Scalar>> sweep_jobs;
+    std::unique_ptr<SweepScheduler> scheduler;
+    std::shared_ptr<const Matrix> validation_data;
+    std::shared_ptr<const Matrix> validation_labels;
+
+    void sweepWorker();
+
 public:
     InterModel () = default;
 
-    void addModel (const Model& mdl, size_t epochs, double learning_rate);
+    InterModel (const InterModel&) = delete;
+    InterModel& operator=(const InterModel&) = delete;
+
+    // waits for a sweep in progress
+    ~InterModel ();
+
+    // The model is moved into the job: pass an rvalue (std::move) to avoid copying its layers.
+    // The future gets the trained model once runThreads or runSweep is done with it.
+    std::future<TrainedModel<Scalar>> addModel (Model<Scalar> mdl, size_t epochs, double learning_rate,
+                                                size_t batch_size = 0);
 
+    // trains every queued model for all of its epochs, num_threads at a time, and returns when done
     void runThreads (int num_threads);
 
-    static void trainModels (TSQueue<ModelObject> &ts_queue);
+    // trains the jobs popped from the queue until it is closed and drained
+    static void trainModels (MPMCQueue<ModelObject<Scalar>> &jobs);
+
+    // Runs the queued models as a hyperparameter sweep on num_threads threads (see SweepOptions),
+    // ranking them by their accuracy on the validation set, and returns at once: the futures become
+    // ready as the models finish or are stopped. wait() joins the threads.
+    void runSweep (int num_threads, std::shared_ptr<const Matrix> validation_data,
+                   std::shared_ptr<const Matrix> validation_labels, const SweepOptions &options = {});
+
+    void wait ();
 };
 
 
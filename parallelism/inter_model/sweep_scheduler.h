@@ -0,0 +1,239 @@
+#ifndef DEEPDENDRO_SWEEP_SCHEDULER_H
+#define DEEPDENDRO_SWEEP_SCHEDULER_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <numeric>
+#include <vector>
+
+// How InterModel::runSweep trains its configurations (the queued models).
+// With successive halving every configuration first trains min_epochs epochs (rung 0); the best
+// 1/reduction of a rung then continue to rung k + 1, min_epochs * reduction^(k + 1) epochs in total,
+// the others stop there. A configuration never trains past its own epoch count.
+// Synchronous halving ranks a rung once all its configurations are done; asynchronous halving (ASHA)
+// promotes a configuration as soon as it ranks in the top 1/reduction of the results its rung has so
+// far, so no thread waits for the slowest configuration of a rung.
+struct SweepOptions {
+    enum class Order {
+        // as queued
+        queued,
+        // highest estimated cost (Model::epochCost times the epochs) first: the long jobs do not end up
+        // alone at the end of the sweep
+        longest_first,
+        // cheapest first: the first results come early
+        shortest_first
+    };
+
+    // off: every configuration trains all of its epochs
+    bool successive_halving = true;
+    bool asynchronous = true;
+    size_t min_epochs = 1;
+    size_t reduction = 3;
+    Order order = Order::longest_first;
+};
+
+// The bookkeeping of a sweep, shared by its threads: which configuration trains next, for how many
+// epochs, and which ones stop. Configurations are indices; a rung's results are validation scores,
+// higher being better.
+class SweepScheduler {
+public:
+    struct Task {
+        size_t config;
+        // the rung the training brings the configuration to
+        size_t rung;
+        // epochs to train now; 0 for a configuration that stops (the sweep is done with it)
+        size_t epochs;
+    };
+
+private:
+    enum class State {
+        pending,
+        running,
+        // trained up to its rung, waiting to be promoted or stopped
+        waiting,
+        done
+    };
+
+    struct Rung {
+        // (score, config) of every configuration that reached this rung
+        std::vector<std::pair<double, size_t>> results;
+        size_t running = 0;
+    };
+
+    SweepOptions options;
+    std::vector<size_t> max_epochs;
+    std::vector<size_t> epochs_done;
+    std::vector<size_t> rung_of;
+    std::vector<State> state;
+    std::deque<size_t> pending;
+    std::vector<Rung> rungs;
+    size_t running = 0;
+    std::mutex mtx;
+    std::condition_variable cv;
+
+    // total epochs of a configuration at rung k
+    size_t budget(const size_t config, const size_t rung) const {
+        if (!options.successive_halving) {
+            return max_epochs[config];
+        }
+        size_t epochs = std::max<size_t>(options.min_epochs, 1);
+        for (size_t k = 0; k < rung && epochs < max_epochs[config]; ++k) {
+            epochs *= std::max<size_t>(options.reduction, 2);
+        }
+        return std::min(epochs, max_epochs[config]);
+    }
+
+    Rung &rung(const size_t k) {
+        if (rungs.size() <= k) {
+            rungs.resize(k + 1);
+        }
+        return rungs[k];
+    }
+
+    // no configuration will reach rung k any more: its ranking is final
+    bool closed(const size_t k) {
+        if (!pending.empty()) {
+            return false;
+        }
+        for (size_t j = 0; j <= k; ++j) {
+            if (rung(j).running != 0 || (j < k && !promoted_all(j))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // the configurations of rung k in the top 1/reduction, best first; once the rung is closed the
+    // best one always is, so that one configuration trains all of its epochs
+    std::vector<size_t> top(const size_t k) {
+        auto ranked = rung(k).results;
+        std::sort(ranked.begin(), ranked.end(), [](const auto &a, const auto &b) {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        });
+        size_t count = ranked.size() / std::max<size_t>(options.reduction, 2);
+        if (count == 0 && !ranked.empty() && closed(k)) {
+            count = 1;
+        }
+        std::vector<size_t> best(count);
+        for (size_t i = 0; i < count; ++i) {
+            best[i] = ranked[i].second;
+        }
+        return best;
+    }
+
+    bool promoted_all(const size_t k) {
+        for (const size_t config: top(k)) {
+            if (state[config] == State::waiting && rung_of[config] == k) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool promotable(const size_t k) {
+        return options.asynchronous || closed(k);
+    }
+
+public:
+    // costs: estimated cost of every configuration, for options.order
+    SweepScheduler(std::vector<size_t> epochs, const std::vector<double> &costs, const SweepOptions &options)
+            : options(options), max_epochs(std::move(epochs)), epochs_done(max_epochs.size(), 0),
+              rung_of(max_epochs.size(), 0), state(max_epochs.size(), State::pending) {
+        std::vector<size_t> order(max_epochs.size());
+        std::iota(order.begin(), order.end(), 0);
+        if (options.order != SweepOptions::Order::queued) {
+            const bool longest = options.order == SweepOptions::Order::longest_first;
+            std::stable_sort(order.begin(), order.end(), [&](const size_t a, const size_t b) {
+                return longest ? costs[a] > costs[b] : costs[a] < costs[b];
+            });
+        }
+        pending.assign(order.begin(), order.end());
+    }
+
+    // The next task: a promotion (highest rung first), else a configuration not started yet, else a
+    // configuration that stops. Blocks while there is none but others are still training; false once
+    // the sweep is over.
+    bool next(Task &task) {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (true) {
+            // stops: the waiting configurations of a closed rung that are not in its top
+            for (size_t k = 0; k < rungs.size(); ++k) {
+                if (!closed(k)) {
+                    continue;
+                }
+                const std::vector<size_t> best = top(k);
+                for (const auto &[score, config]: rungs[k].results) {
+                    if (state[config] == State::waiting && rung_of[config] == k &&
+                        std::find(best.begin(), best.end(), config) == best.end()) {
+                        state[config] = State::done;
+                        task = {config, k, 0};
+                        return true;
+                    }
+                }
+            }
+            for (size_t k = rungs.size(); k-- > 0;) {
+                if (!promotable(k)) {
+                    continue;
+                }
+                for (const size_t config: top(k)) {
+                    if (state[config] == State::waiting && rung_of[config] == k) {
+                        state[config] = State::running;
+                        ++running;
+                        ++rung(k + 1).running;
+                        task = {config, k + 1, budget(config, k + 1) - epochs_done[config]};
+                        return true;
+                    }
+                }
+            }
+            if (!pending.empty()) {
+                const size_t config = pending.front();
+                pending.pop_front();
+                state[config] = State::running;
+                ++running;
+                ++rung(0).running;
+                task = {config, 0, budget(config, 0)};
+                return true;
+            }
+            if (running == 0) {
+                return false;
+            }
+            cv.wait(lock);
+        }
+    }
+
+    // the configuration of `task` trained and scored `score`; true if it is done, with all its epochs
+    bool report(const Task &task, const double score) {
+        bool finished;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            const size_t config = task.config;
+            epochs_done[config] += task.epochs;
+            rung_of[config] = task.rung;
+            --running;
+            --rungs[task.rung].running;
+            finished = epochs_done[config] >= max_epochs[config];
+            // a finished configuration still ranks in its rung, it just cannot be promoted
+            rungs[task.rung].results.emplace_back(score, config);
+            state[config] = finished ? State::done : State::waiting;
+        }
+        cv.notify_all();
+        return finished;
+    }
+
+    // a task failed: the configuration is dropped from the sweep
+    void abandon(const Task &task) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            --running;
+            --rungs[task.rung].running;
+            state[task.config] = State::done;
+        }
+        cv.notify_all();
+    }
+};
+
+
+#endif //DEEPDENDRO_SWEEP_SCHEDULER_H
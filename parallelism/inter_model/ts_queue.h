@@ -8,7 +8,9 @@
 #include <mutex>
 #include <deque>
 #include <condition_variable>
+#include <utility>
 
+// Elements are moved in and out, never copied, so the queue also holds move-only types.
 template<typename T>
 class TSQueue {
     std::mutex mtx;
@@ -20,15 +22,34 @@ public:
     TSQueue(const TSQueue&) = delete;
     TSQueue& operator=(const TSQueue&) = delete;
 
-    void push(const T& el);
+    void push(T &&el);
+
+    // constructs the element in place
+    template<typename... Args>
+    void emplace(Args &&... args);
+
+    // blocks until an element is there
     T pop();
+
+    // never blocks: false, el untouched, if the queue is empty
+    bool try_pop(T &el);
 };
 
 template<typename T>
-void TSQueue<T>::push(const T &el) {
+void TSQueue<T>::push(T &&el) {
     {
         std::lock_guard<std::mutex> lock(mtx);
-        dq.push_back(el);
+        dq.push_back(std::move(el));
+    }
+    cv.notify_one();
+}
+
+template<typename T>
+template<typename... Args>
+void TSQueue<T>::emplace(Args &&... args) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        dq.emplace_back(std::forward<Args>(args)...);
     }
     cv.notify_one();
 }
@@ -37,10 +58,21 @@ template<typename T>
 T TSQueue<T>::pop() {
     std::unique_lock<std::mutex> lock(mtx);
     cv.wait(lock, [this](){return !dq.empty();});
-    T el = dq.front();
+    T el = std::move(dq.front());
     dq.pop_front();
     return el;
 }
 
+template<typename T>
+bool TSQueue<T>::try_pop(T &el) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (dq.empty()) {
+        return false;
+    }
+    el = std::move(dq.front());
+    dq.pop_front();
+    return true;
+}
+
 
 #endif //DEEPDENDRO_TS_QUEUE_H
@@ -0,0 +1,271 @@
+#ifndef DEEPDENDRO_MPMC_QUEUE_H
+#define DEEPDENDRO_MPMC_QUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+// Bounded lock-free multi-producer / multi-consumer ring queue (Vyukov's sequenced cells), for data
+// loaders, request paths and job dispatch.
+// Every cell carries a sequence number saying whether it is free for the producer of that lap or holds
+// an element for the consumer of that lap; producers and consumers claim cells by a compare-and-swap on
+// their own position, so neither side ever takes a lock. A batch claims consecutive cells with one CAS.
+// The try_ variants never block. The others wait (push while the queue is full, pop while it is empty),
+// forever or up to a timeout; only a waiting thread touches the mutex, which the other side locks only
+// when someone waits.
+// close() ends the queue: pushes fail from then on, pops drain what is left and then fail, and every
+// waiting thread wakes up. It sets a bit of the producers' position, so a push either claimed its cells
+// before the close, and its elements are drained, or fails.
+// T must be default-constructible and move-assignable; the cells hold an element each.
+template<typename T>
+class MPMCQueue {
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    // set in enqueue_pos once the queue is closed
+    static constexpr size_t closed_bit = size_t(1) << (sizeof(size_t) * CHAR_BIT - 1);
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+
+    alignas(64) std::atomic<size_t> enqueue_pos{0};
+    alignas(64) std::atomic<size_t> dequeue_pos{0};
+    // threads waiting in push (for room) or pop (for elements), and a counter bumped whenever one of them
+    // may have something to retry
+    std::atomic<size_t> waiting{0};
+    std::atomic<size_t> generation{0};
+    std::mutex mtx;
+    std::condition_variable cv;
+
+    void wake() {
+        // orders the cell just published before the read of `waiting` (the waiter does the converse)
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_relaxed) != 0) {
+            generation.fetch_add(1, std::memory_order_release);
+            // taken so that a waiter between its check of `generation` and its wait cannot miss the notification
+            { std::lock_guard<std::mutex> lock(mtx); }
+            cv.notify_all();
+        }
+    }
+
+    // retries `attempt` until it succeeds, `ended` holds or the deadline (if any) passes; the attempts
+    // run without the mutex, which the successful one takes in wake()
+    template<typename Attempt, typename Ended, typename Clock, typename Duration>
+    bool wait_for_success(Attempt attempt, Ended ended, const std::chrono::time_point<Clock, Duration> *deadline) {
+        if (attempt()) {
+            return true;
+        }
+        waiting.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool done = false;
+        while (true) {
+            const size_t seen = generation.load(std::memory_order_acquire);
+            if ((done = attempt()) || ended()) {
+                break;
+            }
+            std::unique_lock<std::mutex> lock(mtx);
+            const auto changed = [&] { return generation.load(std::memory_order_acquire) != seen; };
+            if (deadline == nullptr) {
+                cv.wait(lock, changed);
+            } else if (!cv.wait_until(lock, *deadline, changed)) {
+                lock.unlock();
+                done = attempt();
+                break;
+            }
+        }
+        waiting.fetch_sub(1, std::memory_order_relaxed);
+        return done;
+    }
+
+    // claims up to n consecutive cells whose sequence is `ready` laps ahead of their position:
+    // 0 for producers (free cells), 1 for consumers (filled cells); returns the first position.
+    // Claims nothing once the position carries closed_bit.
+    size_t claim(std::atomic<size_t> &position, const size_t ready, size_t &n) {
+        size_t pos = position.load(std::memory_order_relaxed);
+        while (true) {
+            if (pos & closed_bit) {
+                n = 0;
+                return pos;
+            }
+            size_t available = 0;
+            while (available < n) {
+                const size_t sequence = cells[(pos + available) & mask].sequence.load(std::memory_order_acquire);
+                if (sequence != pos + available + ready) {
+                    break;
+                }
+                ++available;
+            }
+            if (available == 0) {
+                const size_t sequence = cells[pos & mask].sequence.load(std::memory_order_acquire);
+                // behind: another thread claimed the cell meanwhile, retry from the current position
+                if (static_cast<std::ptrdiff_t>(sequence - (pos + ready)) > 0) {
+                    pos = position.load(std::memory_order_relaxed);
+                    continue;
+                }
+                n = 0;
+                return pos;
+            }
+            if (position.compare_exchange_weak(pos, pos + available, std::memory_order_relaxed)) {
+                n = available;
+                return pos;
+            }
+        }
+    }
+
+public:
+    // the capacity is rounded up to a power of two
+    explicit MPMCQueue(const size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        cells = std::make_unique<Cell[]>(size);
+        for (size_t i = 0; i < size; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        mask = size - 1;
+    }
+
+    MPMCQueue(const MPMCQueue &) = delete;
+    MPMCQueue &operator=(const MPMCQueue &) = delete;
+
+    size_t capacity() const {
+        return mask + 1;
+    }
+
+    // exact when no thread is pushing or popping
+    size_t size_approx() const {
+        const size_t tail = enqueue_pos.load(std::memory_order_relaxed) & ~closed_bit;
+        const size_t head = dequeue_pos.load(std::memory_order_relaxed);
+        return tail >= head ? tail - head : 0;
+    }
+
+    void close() {
+        enqueue_pos.fetch_or(closed_bit, std::memory_order_seq_cst);
+        generation.fetch_add(1, std::memory_order_release);
+        { std::lock_guard<std::mutex> lock(mtx); }
+        cv.notify_all();
+    }
+
+    bool closed() const {
+        return (enqueue_pos.load(std::memory_order_acquire) & closed_bit) != 0;
+    }
+
+    // closed, and every element pushed before the close popped (a push still writing the element it
+    // claimed before the close keeps the queue from being drained until the element is there and popped)
+    bool drained() const {
+        const size_t tail = enqueue_pos.load(std::memory_order_acquire);
+        return (tail & closed_bit) != 0 && dequeue_pos.load(std::memory_order_acquire) == (tail & ~closed_bit);
+    }
+
+    // Pushes up to n elements from `first` on, as many as there is room for, and returns how many.
+    // The elements are assigned from *first, *(first + 1), ...: a std::move_iterator moves them.
+    template<typename Iterator>
+    size_t try_push_batch(Iterator first, size_t n) {
+        const size_t pos = claim(enqueue_pos, 0, n);
+        for (size_t i = 0; i < n; ++i, ++first) {
+            Cell &cell = cells[(pos + i) & mask];
+            cell.value = *first;
+            cell.sequence.store(pos + i + 1, std::memory_order_release);
+        }
+        if (n != 0) {
+            wake();
+        }
+        return n;
+    }
+
+    // Pops up to n elements into out, out + 1, ... and returns how many there were.
+    template<typename OutputIterator>
+    size_t try_pop_batch(OutputIterator out, size_t n) {
+        const size_t pos = claim(dequeue_pos, 1, n);
+        for (size_t i = 0; i < n; ++i, ++out) {
+            Cell &cell = cells[(pos + i) & mask];
+            *out = std::move(cell.value);
+            cell.sequence.store(pos + i + mask + 1, std::memory_order_release);
+        }
+        if (n != 0) {
+            wake();
+        }
+        return n;
+    }
+
+    // false, and el untouched, if the queue is full or closed
+    template<typename U>
+    bool try_push(U &&el) {
+        size_t n = 1;
+        const size_t pos = claim(enqueue_pos, 0, n);
+        if (n == 0) {
+            return false;
+        }
+        Cell &cell = cells[pos & mask];
+        cell.value = std::forward<U>(el);
+        cell.sequence.store(pos + 1, std::memory_order_release);
+        wake();
+        return true;
+    }
+
+    bool try_pop(T &el) {
+        return try_pop_batch(&el, 1) == 1;
+    }
+
+    // waits for room; false if the queue is closed
+    template<typename U>
+    bool push(U &&el) {
+        return wait_for_success([&] { return try_push(std::forward<U>(el)); }, [&] { return closed(); },
+                                static_cast<const std::chrono::steady_clock::time_point *>(nullptr));
+    }
+
+    // constructs the element from args and waits for room for it; false if the queue is closed
+    template<typename... Args>
+    bool emplace(Args &&... args) {
+        return push(T(std::forward<Args>(args)...));
+    }
+
+    // waits up to `timeout` for room; false on a timeout or if the queue is closed
+    template<typename U, typename Rep, typename Period>
+    bool push_for(U &&el, const std::chrono::duration<Rep, Period> &timeout) {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        return wait_for_success([&] { return try_push(std::forward<U>(el)); }, [&] { return closed(); },
+                                &deadline);
+    }
+
+    // waits for an element; false once the queue is drained
+    bool pop(T &el) {
+        return wait_for_success([&] { return try_pop(el); }, [&] { return drained(); },
+                                static_cast<const std::chrono::steady_clock::time_point *>(nullptr));
+    }
+
+    // waits up to `timeout` for an element; false on a timeout or once the queue is drained
+    template<typename Rep, typename Period>
+    bool pop_for(T &el, const std::chrono::duration<Rep, Period> &timeout) {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        return wait_for_success([&] { return try_pop(el); }, [&] { return drained(); }, &deadline);
+    }
+
+    // waits for at least one element, then pops up to n; 0 once the queue is drained
+    template<typename OutputIterator>
+    size_t pop_batch(OutputIterator out, const size_t n) {
+        size_t popped = 0;
+        wait_for_success([&] { return (popped = try_pop_batch(out, n)) != 0; }, [&] { return drained(); },
+                         static_cast<const std::chrono::steady_clock::time_point *>(nullptr));
+        return popped;
+    }
+
+    // the same, waiting up to `timeout`; 0 on a timeout
+    template<typename OutputIterator, typename Rep, typename Period>
+    size_t pop_batch_for(OutputIterator out, const size_t n, const std::chrono::duration<Rep, Period> &timeout) {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        size_t popped = 0;
+        wait_for_success([&] { return (popped = try_pop_batch(out, n)) != 0; }, [&] { return drained(); },
+                         &deadline);
+        return popped;
+    }
+};
+
+
+#endif //DEEPDENDRO_MPMC_QUEUE_H
@@ -4,16 +4,17 @@
 
 #include "CIFAR10_Reader.h"
 
-ImagesAndLabels load_cifar10(const std::string& filepath) {
+template<typename Scalar>
+ImagesAndLabels<Scalar> load_cifar10(const std::string& filepath) {
     std::ifstream file(filepath, std::ios::binary);
     if(file.is_open()) {
         std::vector<char> buffer(std::istreambuf_iterator<char>(file), {});
 
-        Images data_vector;
-        Labels labels_vector;
+        Images<Scalar> data_vector;
+        Labels<Scalar> labels_vector;
 
         for(int img = 0; img < 10000; ++img) {
-            Image data_tensor(3, 32, 32);
+            Image<Scalar> data_tensor(3, 32, 32);
             int offset = img * 3073; // start from label byte
             labels_vector.push_back(static_cast<unsigned char>(buffer[offset++]));
             for(int ch = 0; ch < 3; ++ch) {
@@ -32,7 +33,8 @@ ImagesAndLabels load_cifar10(const std::string& filepath) {
 }
 
 
-std::pair<ImagesAndLabels, ImagesAndLabels> load_cifar10_whole(const std::string& cifar_dir_bins_path){
+template<typename Scalar>
+std::pair<ImagesAndLabels<Scalar>, ImagesAndLabels<Scalar>> load_cifar10_whole(const std::string& cifar_dir_bins_path){
     std::array<std::string, 6> bins_paths = {
             cifar_dir_bins_path + "/data_batch_1.bin",
             cifar_dir_bins_path + "/data_batch_2.bin",
@@ -42,15 +44,20 @@ std::pair<ImagesAndLabels, ImagesAndLabels> load_cifar10_whole(const std::string
             cifar_dir_bins_path + "/test_batch.bin"
     };
 
-    ImagesAndLabels training_vector;
+    ImagesAndLabels<Scalar> training_vector;
 
     for(size_t i = 0; i < 4; ++i) {
-        ImagesAndLabels data = load_cifar10(bins_paths[i]);
+        ImagesAndLabels<Scalar> data = load_cifar10<Scalar>(bins_paths[i]);
         training_vector.first.insert(training_vector.first.end(), data.first.begin(), data.first.end());
         training_vector.second.insert(training_vector.second.end(), data.second.begin(), data.second.end());
     }
 
-    ImagesAndLabels test_vector = load_cifar10(bins_paths[5]);
+    ImagesAndLabels<Scalar> test_vector = load_cifar10<Scalar>(bins_paths[5]);
 
     return {training_vector, test_vector};
-}
\ No newline at end of file
+}
+
+template ImagesAndLabels<float> load_cifar10<float>(const std::string& filepath);
+template ImagesAndLabels<double> load_cifar10<double>(const std::string& filepath);
+template std::pair<ImagesAndLabels<float>, ImagesAndLabels<float>> load_cifar10_whole<float>(const std::string&);
+template std::pair<ImagesAndLabels<double>, ImagesAndLabels<double>> load_cifar10_whole<double>(const std::string&);
\ No newline at end of file
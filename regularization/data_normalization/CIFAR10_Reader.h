@@ -12,15 +12,21 @@
 #include <Eigen/Core>
 
 
-typedef Eigen::Tensor<double, 3> Image;
-typedef std::vector<Image> Images;
-typedef std::vector<double> Labels;
-typedef std::pair<Images, Labels> ImagesAndLabels;
+template<typename Scalar = double>
+using Image = Eigen::Tensor<Scalar, 3>;
+template<typename Scalar = double>
+using Images = std::vector<Image<Scalar>>;
+template<typename Scalar = double>
+using Labels = std::vector<Scalar>;
+template<typename Scalar = double>
+using ImagesAndLabels = std::pair<Images<Scalar>, Labels<Scalar>>;
 
 
-ImagesAndLabels load_cifar10_batch(const std::string& filepath);
+template<typename Scalar = double>
+ImagesAndLabels<Scalar> load_cifar10(const std::string& filepath);
 
-std::pair<ImagesAndLabels, ImagesAndLabels> load_cifar10_whole(const std::string& cifar_dir_bins_path);
+template<typename Scalar = double>
+std::pair<ImagesAndLabels<Scalar>, ImagesAndLabels<Scalar>> load_cifar10_whole(const std::string& cifar_dir_bins_path);
 
 
 
@@ -9,9 +9,10 @@
 
 #include "Layer.h"
 
+template<typename Scalar = double>
 struct DataSets {
-    MatrixXd testData;
-    MatrixXd testLabels;
-    MatrixXd trainData;
-    MatrixXd trainLabels;
+    MatrixT<Scalar> testData;
+    MatrixT<Scalar> testLabels;
+    MatrixT<Scalar> trainData;
+    MatrixT<Scalar> trainLabels;
 } ;
\ No newline at end of file
@@ -26,20 +26,22 @@ void MNISTProcess::skipHeaders(const std::string &imageFilename, const std::stri
     }
 }
 
-VectorXd MNISTProcess::readImg(int height, int width) {
-    MatrixXd imgMatrix(height, width);  // create a MatrixXd to store the image data
+template<typename Scalar>
+VectorT<Scalar> MNISTProcess::readImg(int height, int width) {
+    MatrixT<Scalar> imgMatrix(height, width);  // create a MatrixXd to store the image data
     for (int j = 0; j < height; ++j) {
         for (int i = 0; i < width; ++i) {
             image.read(&number, sizeof(char));
             imgMatrix(j, i) = (number==0)? 0: 1;
         }
     }
-    return VectorXd::Map(imgMatrix.data(), height * width);;
+    return VectorT<Scalar>::Map(imgMatrix.data(), height * width);;
 }
 
-VectorXd MNISTProcess::readLbl() {
+template<typename Scalar>
+VectorT<Scalar> MNISTProcess::readLbl() {
     label.read(&number, sizeof(char));
-    MatrixXd oneHot(classesNum, 1);
+    MatrixT<Scalar> oneHot(classesNum, 1);
     for (int i = 0; i < classesNum; ++i) {
         oneHot(i, 0) = 0.0;
     }
@@ -47,32 +49,36 @@ VectorXd MNISTProcess::readLbl() {
     return oneHot;
 }
 
-DataSets MNISTProcess::getData(std::string pathToMNIST) {
+template<typename Scalar>
+DataSets<Scalar> MNISTProcess::getData(std::string pathToMNIST) {
+    using Matrix = MatrixT<Scalar>;
+    using Vector = VectorT<Scalar>;
+
     int numTrainImg = 60000;
     int numTestImg = 10000;
-    DataSets data = DataSets();
+    DataSets<Scalar> data = DataSets<Scalar>();
 
     MNISTProcess mnistProcessTrain = MNISTProcess();
     mnistProcessTrain.skipHeaders(pathToMNIST + "/train-images.idx3-ubyte", pathToMNIST + "/train-labels.idx1-ubyte", 16, 8);
     MNISTProcess mnistProcessTest = MNISTProcess();
     mnistProcessTest.skipHeaders(pathToMNIST + "/t10k-images.idx3-ubyte", pathToMNIST + "/t10k-labels.idx1-ubyte", 16, 8);
 
-    data.trainData = MatrixXd (784, numTrainImg);
-    data.trainLabels = MatrixXd (10, numTrainImg);
-    data.testData = MatrixXd (784, numTestImg);
-    data.testLabels = MatrixXd (10, numTestImg);
+    data.trainData = Matrix (784, numTrainImg);
+    data.trainLabels = Matrix (10, numTrainImg);
+    data.testData = Matrix (784, numTestImg);
+    data.testLabels = Matrix (10, numTestImg);
 
 
     for (int sample = 0; sample < numTrainImg; ++sample) {
-        VectorXd oneHotLabel = mnistProcessTrain.readLbl();
-        VectorXd flattenedImage = mnistProcessTrain.readImg(28, 28);
+        Vector oneHotLabel = mnistProcessTrain.readLbl<Scalar>();
+        Vector flattenedImage = mnistProcessTrain.readImg<Scalar>(28, 28);
         data.trainData.col(sample) = flattenedImage;
         data.trainLabels.col(sample) = oneHotLabel;
     }
 
     for (int sample = 0; sample < numTestImg; ++sample) {
-        VectorXd oneHotLabel = mnistProcessTest.readLbl();
-        VectorXd flattenedImage = mnistProcessTest.readImg(28, 28);
+        Vector oneHotLabel = mnistProcessTest.readLbl<Scalar>();
+        Vector flattenedImage = mnistProcessTest.readImg<Scalar>(28, 28);
         data.testData.col(sample) = flattenedImage;
         data.testLabels.col(sample) = oneHotLabel;
     }
@@ -81,4 +87,7 @@ DataSets MNISTProcess::getData(std::string pathToMNIST) {
 
 MNISTProcess::~MNISTProcess() {
     image.close();
-}
\ No newline at end of file
+}
+
+template DataSets<float> MNISTProcess::getData<float>(std::string pathToMNIST);
+template DataSets<double> MNISTProcess::getData<double>(std::string pathToMNIST);
@@ -21,11 +21,14 @@ public:
     void skipHeaders(const std::string &imageFilename, const std::string &labelFilename,
                                    int skipBytesImg, int skipBytesLab);
 
-    VectorXd readImg(int height, int width);
+    template<typename Scalar = double>
+    VectorT<Scalar> readImg(int height, int width);
 
-    VectorXd readLbl();
+    template<typename Scalar = double>
+    VectorT<Scalar> readLbl();
 
-    DataSets getData(std::string pathToMNIST);
+    template<typename Scalar = double>
+    DataSets<Scalar> getData(std::string pathToMNIST);
 
     ~MNISTProcess();
 };
@@ -4,6 +4,10 @@
 
 #include "dataProcessing.h"
 
-MatrixXd DataProcessing::flatten(const MatrixXd &data){
+template<typename Scalar>
+MatrixT<Scalar> DataProcessing::flatten(const MatrixT<Scalar> &data){
     return data.reshaped();
-}
\ No newline at end of file
+}
+
+template MatrixT<float> DataProcessing::flatten<float>(const MatrixT<float> &data);
+template MatrixT<double> DataProcessing::flatten<double>(const MatrixT<double> &data);
\ No newline at end of file
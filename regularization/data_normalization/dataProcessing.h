@@ -10,7 +10,8 @@
 
 class DataProcessing {
 public:
-    static MatrixXd flatten(const MatrixXd &data);
+    template<typename Scalar>
+    static MatrixT<Scalar> flatten(const MatrixT<Scalar> &data);
 };
 
 
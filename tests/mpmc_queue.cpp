@@ -0,0 +1,156 @@
+// MPMCQueue: single-threaded semantics, timeouts, and many producers and consumers racing a close(),
+// after which every element whose push succeeded must have been popped exactly once.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "mpmc_queue.h"
+
+namespace {
+    bool expect(const bool condition, const char *what) {
+        if (!condition) {
+            std::printf("FAILED: %s\n", what);
+        }
+        return condition;
+    }
+
+    bool single_thread() {
+        bool ok = true;
+        MPMCQueue<std::string> queue(3);
+        ok &= expect(queue.capacity() == 4, "the capacity is rounded up to a power of two");
+        for (int i = 0; i < 4; ++i) {
+            ok &= expect(queue.try_push(std::to_string(i)), "try_push with room");
+        }
+        std::string kept = "kept";
+        ok &= expect(!queue.try_push(std::move(kept)) && kept == "kept", "try_push on a full queue leaves el");
+        std::string out[8];
+        ok &= expect(queue.try_pop_batch(out, 3) == 3 && out[0] == "0" && out[2] == "2", "batch pop in order");
+        const std::string more[] = {"4", "5", "6"};
+        ok &= expect(queue.try_push_batch(more, 3) == 3, "batch push wraps around");
+        ok &= expect(queue.size_approx() == 4, "size_approx");
+        ok &= expect(queue.try_pop_batch(out, 8) == 4 && out[0] == "3" && out[3] == "6", "batch pop wraps around");
+        ok &= expect(!queue.try_pop(out[0]), "try_pop on an empty queue");
+
+        using namespace std::chrono_literals;
+        const auto began = std::chrono::steady_clock::now();
+        ok &= expect(!queue.pop_for(out[0], 20ms) && std::chrono::steady_clock::now() - began >= 20ms,
+                     "pop_for times out");
+        ok &= expect(queue.try_push(std::string("last")), "try_push");
+        queue.close();
+        ok &= expect(queue.closed() && !queue.try_push(std::string("late")) && !queue.push(std::string("late")),
+                     "pushes fail once closed");
+        ok &= expect(queue.pop(out[0]) && out[0] == "last" && !queue.pop(out[0]) && queue.drained(),
+                     "pops drain the closed queue, then fail");
+
+        // move-only elements, built in place
+        MPMCQueue<std::unique_ptr<int>> owners(2);
+        std::unique_ptr<int> owner;
+        ok &= expect(owners.emplace(new int(7)) && owners.try_pop(owner) && owner && *owner == 7,
+                     "emplace and try_pop a move-only element");
+        return ok;
+    }
+
+    // a consumer waiting on an empty queue returns when it is closed
+    bool close_wakes_consumers() {
+        MPMCQueue<int> queue(4);
+        std::atomic<int> returned{0};
+        std::vector<std::thread> consumers;
+        for (int i = 0; i < 3; ++i) {
+            consumers.emplace_back([&] {
+                int value;
+                if (!queue.pop(value)) {
+                    returned.fetch_add(1);
+                }
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        queue.close();
+        for (auto &consumer: consumers) {
+            consumer.join();
+        }
+        return expect(returned.load() == 3, "close() wakes the waiting consumers");
+    }
+
+    // producers push until the queue closes under them; every accepted element must come out once
+    bool racing_close(const size_t round) {
+        constexpr int producers = 4, consumers = 4;
+        constexpr long per_producer = 1 << 20;
+        MPMCQueue<long> queue(64);
+        std::atomic<long> pushed_sum{0}, pushed{0}, popped_sum{0}, popped{0};
+        std::vector<std::thread> threads;
+        for (int p = 0; p < producers; ++p) {
+            threads.emplace_back([&, p] {
+                long sum = 0, count = 0;
+                long batch[8];
+                for (long i = 0; i < per_producer; i += 8) {
+                    for (long j = 0; j < 8; ++j) {
+                        batch[j] = p * per_producer + i + j;
+                    }
+                    if (p % 2 == 0) {
+                        if (!queue.push(batch[0])) {
+                            break;
+                        }
+                        sum += batch[0];
+                        ++count;
+                    } else {
+                        const size_t n = queue.try_push_batch(batch, 8);
+                        for (size_t j = 0; j < n; ++j) {
+                            sum += batch[j];
+                        }
+                        count += static_cast<long>(n);
+                        if (n == 0 && queue.closed()) {
+                            break;
+                        }
+                    }
+                }
+                pushed_sum += sum;
+                pushed += count;
+            });
+        }
+        for (int c = 0; c < consumers; ++c) {
+            threads.emplace_back([&, c] {
+                long sum = 0, count = 0;
+                long batch[16];
+                if (c % 2 == 0) {
+                    while (const size_t n = queue.pop_batch(batch, 16)) {
+                        for (size_t j = 0; j < n; ++j) {
+                            sum += batch[j];
+                        }
+                        count += static_cast<long>(n);
+                    }
+                } else {
+                    long value;
+                    while (queue.pop(value)) {
+                        sum += value;
+                        ++count;
+                    }
+                }
+                popped_sum += sum;
+                popped += count;
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5 + 5 * round));
+        queue.close();
+        for (auto &thread: threads) {
+            thread.join();
+        }
+        const bool ok = popped.load() == pushed.load() && popped_sum.load() == pushed_sum.load();
+        std::printf("round %zu: %ld pushed, %ld popped\n", round, pushed.load(), popped.load());
+        return expect(ok, "every element pushed before the close is popped once");
+    }
+}
+
+int main() {
+    bool ok = single_thread();
+    ok &= close_wakes_consumers();
+    for (size_t round = 0; round < 5; ++round) {
+        ok &= racing_close(round);
+    }
+    std::printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
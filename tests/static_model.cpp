@@ -0,0 +1,47 @@
+// StaticModel::load copies a trained dense Model: both must then predict the same class for every sample,
+// and a model whose shapes or activations differ from the template arguments is refused.
+
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+#include "StaticModel.h"
+
+int main() {
+    srand(1);
+    const Eigen::Index samples = 300;
+    const Eigen::MatrixXf data = Eigen::MatrixXf::Random(16, samples);
+    Eigen::MatrixXf labels = Eigen::MatrixXf::Zero(4, samples);
+    for (Eigen::Index i = 0; i < samples; ++i) {
+        Eigen::Index feature;
+        data.col(i).head(4).maxCoeff(&feature);
+        labels(feature, i) = 1;
+    }
+
+    Model<float> model;
+    model.addInput(data);
+    model.addOutput(labels);
+    model.addDense(12, activation::relu);
+    model.train(5, 0.05, false, 30);
+
+    StaticModel<Dense<16, 12, act::Relu, float>, Dense<12, 4, act::Softmax, float>> fast;
+    fast.load(model);
+    const std::vector<int> expected = model.predict_classes(data);
+    Eigen::Index agree = 0;
+    for (Eigen::Index i = 0; i < samples; ++i) {
+        agree += fast.predict_class(data.col(i)) == expected[static_cast<size_t>(i)];
+    }
+    bool ok = agree == samples;
+    std::printf("StaticModel agrees with Model::predict_classes on %ld of %ld samples\n", static_cast<long>(agree),
+                static_cast<long>(samples));
+
+    StaticModel<Dense<16, 12, act::Sigmoid, float>, Dense<12, 4, act::Softmax, float>> mismatched;
+    try {
+        mismatched.load(model);
+        std::printf("FAILED: a model with other activations was loaded\n");
+        ok = false;
+    } catch (const std::invalid_argument &) {
+    }
+    std::printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
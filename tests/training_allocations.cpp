@@ -0,0 +1,117 @@
+// Steady-state training steps must not allocate: with the default thread budget of 1, a train() call
+// allocates while it sets up (memory plan, arena, permutation) and then never again, so training one
+// more epoch costs no allocation at all. Every heap allocation is counted, Eigen's included (Eigen calls
+// malloc directly, it is counted through glibc's allocator where available).
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include "Model.h"
+
+namespace {
+    std::atomic<size_t> allocations{0};
+}
+
+#ifdef __GLIBC__
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+
+void *malloc(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(pointer, size);
+}
+}
+#else
+void *operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *pointer = std::malloc(size != 0 ? size : 1)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+    std::free(pointer);
+}
+#endif
+
+namespace {
+    // allocations of one train() call of `epochs` epochs, after a first call has warmed the model up
+    template<typename Build>
+    size_t count_training(Build build, const size_t epochs, const size_t batch_size) {
+        Model<double> model;
+        build(model);
+        model.train(1, 0.01, false, batch_size);
+        const size_t before = allocations.load();
+        model.train(epochs, 0.01, false, batch_size);
+        return allocations.load() - before;
+    }
+
+    template<typename Build>
+    bool check(const char *name, Build build, const size_t batch_size) {
+        const size_t one = count_training(build, 1, batch_size);
+        const size_t four = count_training(build, 4, batch_size);
+        const bool ok = one == four;
+        std::printf("%s, batch %zu: %zu allocations for 1 epoch, %zu for 4 epochs: %s\n", name, batch_size, one, four,
+                    ok ? "ok" : "FAILED, the steps allocate");
+        return ok;
+    }
+}
+
+int main() {
+    srand(1);
+    const Eigen::Index samples = 500;
+    auto data = std::make_shared<const Eigen::MatrixXd>(Eigen::MatrixXd::Random(144, samples));
+    Eigen::MatrixXd one_hot = Eigen::MatrixXd::Zero(10, samples);
+    for (Eigen::Index i = 0; i < samples; ++i) {
+        one_hot(i % 10, i) = 1;
+    }
+    auto labels = std::make_shared<const Eigen::MatrixXd>(std::move(one_hot));
+
+    auto dense = [&](Model<double> &model) {
+        model.addInput(data);
+        model.addOutput(labels);
+        model.addDense(64, activation::relu);
+        model.addDense(32, activation::sigmoid);
+    };
+    auto convolutional = [&](Model<double> &model) {
+        model.addInput(data, {12, 12, 1});
+        model.addOutput(labels);
+        model.addConv(4, {3, 3}, activation::relu);
+        model.addMaxPool({2, 2}, {2, 2});
+        model.addFlatten();
+        model.addDense(32, activation::relu);
+    };
+    auto checkpointed = [&](Model<double> &model) {
+        dense(model);
+        CheckpointConfig checkpointing;
+        checkpointing.enabled = true;
+        model.setCheckpointing(checkpointing);
+    };
+
+    bool ok = true;
+    // 100 divides the samples, 64 leaves a short last batch
+    for (const size_t batch: {100, 64}) {
+        ok &= check("dense", dense, batch);
+        ok &= check("convolutional", convolutional, batch);
+        ok &= check("checkpointed", checkpointed, batch);
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}